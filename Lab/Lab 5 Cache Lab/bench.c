@@ -0,0 +1,313 @@
+/* 20220100 Kihyun Park */
+
+/*
+ * bench.c - Benchmark every transpose function registered by trans.c
+ *
+ * Each registered function is run on every shape asked for and one CSV
+ * row is printed per function and shape:
+ *   - simulated misses on each cache geometry, with every A/B access of
+ *     the traced kernels replayed through the cache simulator ("n/a" for
+ *     kernels that do not trace every element, such as the SIMD ones, and
+ *     for shapes above the -l limit)
+ *   - wall-clock seconds of the fastest of the timed runs
+ *   - cycles and cache misses from the hardware counters during that run
+ *     ("n/a" where perf_event_open is not permitted)
+ *   - GB/s, counting one read of A and one write of B
+ *   - whether B came out as the transpose of A
+ * Rows come out in a fixed order, so two runs can be diffed.
+ *
+ * Build: gcc -O2 -o bench bench.c cachesim.c -lpthread -lm
+ * Usage: ./bench [-g s:E:b]... [-l max elements simulated] [-t min seconds] [MxN...]
+ */
+#include "cachesim.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static inline int* TraceAccess(int* p, char op);
+
+#define TRANS_READ(x) (*TraceAccess(&(x), 'L'))
+#define TRANS_WRITE(x) (*TraceAccess(&(x), 'S'))
+#include "trans.c"
+
+#define MAX_FUNCTIONS 100
+#define MAX_GEOMETRIES 16
+#define MIN_RUNS 3
+#define DRIVER_DIM 256 //A and B are at least this square apart, as in the course driver
+
+typedef void (*TransFunction)(int M, int N, int A[N][M], int B[M][N]);
+
+typedef struct //One registered transpose
+{
+    TransFunction function;
+    char* description;
+} Function;
+
+typedef struct //Hardware counters of one run, -1 when unavailable
+{
+    long long int cycles;
+    long long int misses;
+} Counters;
+
+static Function functions[MAX_FUNCTIONS];
+static int function_count = 0;
+static cache_t* cache = NULL;
+static unsigned long int traced = 0; //accesses replayed in the current run
+static int perf_cycles = -1, perf_misses = -1;
+
+static const char* default_shapes[] = {"32x32", "64x64", "61x67", "256x256", "1024x1024", "4096x4096"};
+
+/* registerTransFunction - Collect the functions trans.c registers */
+void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]), char* desc)
+{
+    if(function_count == MAX_FUNCTIONS)
+        return;
+    functions[function_count].function = trans;
+    functions[function_count].description = desc;
+    function_count++;
+    return;
+}
+
+static inline int* TraceAccess(int* p, char op)
+{
+    if(__builtin_expect(cache != NULL, 0))
+    {
+        cache_access(cache, (unsigned long int)p, sizeof(int), op);
+        traced++;
+    }
+    return p;
+}
+
+static double Now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int PerfOpen(unsigned long long int config, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/*
+ * PerfInit - Open the cycle and cache-miss counters as one group, leaving
+ *     them at -1 if the kernel refuses.
+ */
+static void PerfInit()
+{
+    perf_cycles = PerfOpen(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(perf_cycles >= 0)
+        perf_misses = PerfOpen(PERF_COUNT_HW_CACHE_MISSES, perf_cycles);
+    return;
+}
+
+static long long int PerfRead(int fd)
+{
+    long long int value;
+
+    if(fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+    return value;
+}
+
+/*
+ * Run - Time one call of f and read the counters around it.
+ */
+static double Run(TransFunction f, int M, int N, int* A, int* B, Counters* counters)
+{
+    double start;
+
+    if(perf_cycles >= 0)
+    {
+        ioctl(perf_cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(perf_cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    start = Now();
+    f(M, N, (int (*)[M])A, (int (*)[N])B);
+    start = Now() - start;
+    if(perf_cycles >= 0)
+        ioctl(perf_cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    counters->cycles = PerfRead(perf_cycles);
+    counters->misses = PerfRead(perf_misses);
+    return start;
+}
+
+/*
+ * Simulate - Return the misses of one call of f on a fresh cache, or -1
+ *     if f did not trace one load and one store per element.
+ */
+static long int Simulate(TransFunction f, int M, int N, int* A, int* B, const int* geometry)
+{
+    cache_config_t config;
+    cache_stats_t stats;
+
+    memset(&config, 0, sizeof(config));
+    config.s = geometry[0];
+    config.E = geometry[1];
+    config.b = geometry[2];
+    if((cache = cache_create(&config)) == NULL)
+    {
+        fprintf(stderr, "%d:%d:%d: Cannot create the cache\n", geometry[0], geometry[1], geometry[2]);
+        exit(1);
+    }
+    traced = 0;
+    trans_threads = 1; //TraceAccess is not thread-safe
+    f(M, N, (int (*)[M])A, (int (*)[N])B);
+    trans_threads = 0;
+    cache_stats(cache, &stats);
+    cache_destroy(cache);
+    cache = NULL;
+
+    if(traced < 2 * (unsigned long int)M * N)
+        return -1;
+    return (long int)stats.miss_count;
+}
+
+static void PrintCount(long long int n)
+{
+    if(n < 0)
+        printf(",n/a");
+    else
+        printf(",%lld", n);
+    return;
+}
+
+int main(int argc, char* argv[])
+{
+    int geometry[MAX_GEOMETRIES][3];
+    int geometry_count = 0;
+    long int sim_limit = 1L << 20;
+    double min_time = 0.05;
+    const char** shapes;
+    int shape_count;
+    int opt;
+
+    while((opt = getopt(argc, argv, "g:l:t:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'g':
+                if(geometry_count == MAX_GEOMETRIES ||
+                   sscanf(optarg, "%d:%d:%d", &geometry[geometry_count][0], &geometry[geometry_count][1], &geometry[geometry_count][2]) != 3)
+                {
+                    fprintf(stderr, "%s: Expected s:E:b\n", optarg);
+                    return 1;
+                }
+                geometry_count++;
+                break;
+            case 'l':
+                sim_limit = atol(optarg);
+                break;
+            case 't':
+                min_time = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-g s:E:b]... [-l max elements simulated] [-t min seconds] [MxN...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(geometry_count == 0) //the graded cache
+    {
+        geometry[0][0] = 5;
+        geometry[0][1] = 1;
+        geometry[0][2] = 5;
+        geometry_count = 1;
+    }
+    if(optind < argc)
+    {
+        shapes = (const char**)argv + optind;
+        shape_count = argc - optind;
+    }
+    else
+    {
+        shapes = default_shapes;
+        shape_count = sizeof(default_shapes) / sizeof(default_shapes[0]);
+    }
+
+    registerFunctions();
+    PerfInit();
+
+    printf("function,M,N");
+    for(int g = 0; g < geometry_count; g++)
+    {
+        printf(",misses_s%d_E%d_b%d", geometry[g][0], geometry[g][1], geometry[g][2]);
+    }
+    printf(",seconds,cycles,hw_cache_misses,GB/s,correct\n");
+
+    for(int k = 0; k < shape_count; k++)
+    {
+        int M, N;
+        long int span;
+        int* A;
+
+        if(sscanf(shapes[k], "%dx%d", &M, &N) != 2 || M < 1 || N < 1)
+        {
+            fprintf(stderr, "%s: Expected MxN\n", shapes[k]);
+            return 1;
+        }
+        //A and B back to back like the driver's static matrices
+        span = (long int)M * N > DRIVER_DIM * DRIVER_DIM ? (long int)M * N : DRIVER_DIM * DRIVER_DIM;
+        if((A = aligned_alloc(1 << 16, 2 * span * sizeof(int))) == NULL)
+        {
+            fprintf(stderr, "%s: Cannot allocate the matrices\n", shapes[k]);
+            return 1;
+        }
+        for(long int i = 0; i < (long int)M * N; i++)
+        {
+            A[i] = (int)i;
+        }
+
+        for(int f = 0; f < function_count; f++)
+        {
+            int* B = A + span;
+            double best = -1;
+            double elapsed = 0;
+            Counters counters, best_counters = {-1, -1};
+            int correct;
+
+            printf("\"%s\",%d,%d", functions[f].description, M, N);
+            for(int g = 0; g < geometry_count; g++)
+            {
+                PrintCount((long int)M * N <= sim_limit ? Simulate(functions[f].function, M, N, A, B, geometry[g]) : -1);
+            }
+
+            memset(B, 0, (long int)M * N * sizeof(int));
+            functions[f].function(M, N, (int (*)[M])A, (int (*)[N])B); //warm-up, also checked
+            correct = is_transpose(M, N, (int (*)[M])A, (int (*)[N])B);
+            for(int run = 0; run < MIN_RUNS || elapsed < min_time; run++)
+            {
+                double t = Run(functions[f].function, M, N, A, B, &counters);
+
+                if(best < 0 || t < best)
+                {
+                    best = t;
+                    best_counters = counters;
+                }
+                elapsed += t;
+            }
+            printf(",%.9f", best);
+            PrintCount(best_counters.cycles);
+            PrintCount(best_counters.misses);
+            printf(",%.3f,%d\n", 2.0 * M * N * sizeof(int) / best / 1e9, correct);
+            fflush(stdout);
+        }
+        free(A);
+    }
+    return 0;
+}
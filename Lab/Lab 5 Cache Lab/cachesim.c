@@ -0,0 +1,912 @@
+/* 20220100 Kihyun Park */
+
+/*
+ * cachesim.c - Reentrant set-associative LRU cache simulator
+ *
+ * All state of a simulated cache lives in its cache_t: the lines, the
+ * counters and the prefetcher tables. See cachesim.h for the interface.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cachesim.h"
+
+#define STRIDE_ENTRIES 64 //stride detector table size
+#define STRIDE_REGION 12  //stride detector region bits (4KB)
+#define STREAM_DEPTH 4    //lines per stream buffer
+#define BATCH_AHEAD 8     //cache_access_n prefetches the set this many accesses ahead
+#define SNAPSHOT_MAGIC "CSIMSTA2" //Header of cache snapshots
+#define SNAPSHOT_MAGIC_LEN 8
+
+typedef struct //Cache Block
+{
+    int valid_bit;
+    unsigned long int tag;
+    int LRU;
+    int prefetched; //filled by the prefetcher and not used yet
+} Line;
+
+typedef struct //Stride detector entry
+{
+    unsigned long int region;
+    unsigned long int last_block;
+    long int stride;
+    int confidence;
+} StrideEntry;
+
+typedef struct //Stream buffer, a FIFO of upcoming blocks
+{
+    unsigned long int block[STREAM_DEPTH];
+    int head;
+    int count;
+    unsigned long int last_use;
+} StreamBuffer;
+
+struct cache
+{
+    cache_config_t config;
+    int s; //Number of set index bits
+    int S; //Number of sets
+    int E; //Number of lines per set
+    int b; //Number of block bits
+    Line** sets; //Cache Memory
+    cache_stats_t stats;
+
+    StrideEntry stride_table[STRIDE_ENTRIES];
+    StreamBuffer* stream_buffers;
+    unsigned long int stream_clock;
+    cache_count_t prefetch_evicted; //odd count: evicted by a prefetch, not missed on since
+    int prefetch_hit; //last demand hit was on a prefetched line
+};
+
+static int CacheSimulator(cache_t* cache, unsigned long int address, long int* line, int* prefetched);
+static int Prefetch(cache_t* cache, unsigned long int address, int result);
+
+cache_t* cache_create(const cache_config_t* config)
+{
+    cache_t* cache;
+
+    if(config->s < 0 || config->s > 30 || config->E < 1 || config->b < 0 || config->b > 30)
+        return NULL;
+    if(config->E > (1 << 30) >> config->s) //at most 2^30 lines in all
+        return NULL;
+
+    if((cache = (cache_t*)calloc(1, sizeof(cache_t))) == NULL)
+        return NULL;
+    cache->config = *config;
+    cache->s = config->s;
+    cache->S = 1 << config->s;
+    cache->E = config->E;
+    cache->b = config->b;
+
+    if((cache->sets = (Line**)calloc(cache->S, sizeof(Line*))) == NULL)
+    {
+        free(cache);
+        return NULL;
+    }
+    for(int i = 0; i < cache->S; i++)
+    {
+        if((cache->sets[i] = (Line*)calloc(cache->E, sizeof(Line))) == NULL)
+        {
+            cache_destroy(cache);
+            return NULL;
+        }
+    }
+
+    if(cache->config.prefetch_degree <= 0)
+    {
+        switch(cache->config.prefetch)
+        {
+            case CACHE_PREFETCH_NEXT:
+                cache->config.prefetch_degree = 1;
+                break;
+            case CACHE_PREFETCH_STRIDE:
+                cache->config.prefetch_degree = 2;
+                break;
+            case CACHE_PREFETCH_STREAM:
+                cache->config.prefetch_degree = 4;
+                break;
+        }
+    }
+    if(cache->config.prefetch == CACHE_PREFETCH_STREAM)
+    {
+        cache->stream_buffers = (StreamBuffer*)calloc(cache->config.prefetch_degree, sizeof(StreamBuffer));
+        if(cache->stream_buffers == NULL)
+        {
+            cache_destroy(cache);
+            return NULL;
+        }
+    }
+    return cache;
+}
+
+void cache_destroy(cache_t* cache)
+{
+    if(cache == NULL)
+        return;
+
+    for(int i = 0; i < cache->S; i++)
+    {
+        free(cache->sets[i]);
+    }
+    free(cache->sets);
+    free(cache->stream_buffers);
+    cache_count_free(&cache->prefetch_evicted);
+    free(cache);
+    return;
+}
+
+const cache_config_t* cache_config(const cache_t* cache)
+{
+    return &cache->config;
+}
+
+/*
+ * SimulateLine - Run one demand access through the cache and the
+ *     prefetcher and count it.
+ */
+static int SimulateLine(cache_t* cache, unsigned long int address)
+{
+    int prefetched;
+    int result = CacheSimulator(cache, address, NULL, &prefetched);
+
+    if(prefetched && result == CACHE_HIT)
+    {
+        cache->stats.prefetch_useful++;
+        cache->prefetch_hit = 1;
+    }
+    else if(prefetched)
+    {
+        cache->stats.prefetch_useless++; //evicted before any use
+    }
+    if(cache->config.prefetch != CACHE_PREFETCH_NONE)
+        result = Prefetch(cache, address, result);
+
+    switch(result)
+    {
+        case CACHE_HIT_EVICTION:
+            cache->stats.eviction_count++;
+            /* fall through */
+        case CACHE_HIT:
+            cache->stats.hit_count++;
+            break;
+        case CACHE_MISS_EVICTION:
+            cache->stats.eviction_count++;
+            /* fall through */
+        case CACHE_MISS:
+            cache->stats.miss_count++;
+            break;
+    }
+
+    if(cache->config.observer != NULL)
+        cache->config.observer(cache->config.observer_arg, address, result);
+    return result;
+}
+
+static int AccessLines(cache_t* cache, unsigned long int address, int lines)
+{
+    int misses = 0;
+
+    int result = SimulateLine(cache, address);
+
+    if(result == CACHE_MISS || result == CACHE_MISS_EVICTION)
+        misses++;
+    for(int i = 1; i < lines; i++)
+    {
+        result = SimulateLine(cache, ((address >> cache->b) + i) << cache->b);
+        cache->stats.split_line_count++;
+        if(result == CACHE_MISS || result == CACHE_MISS_EVICTION)
+        {
+            cache->stats.split_miss_count++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+/*
+ * cache_access - Simulate one trace record and return the number of
+ *     misses it caused.
+ */
+int cache_access(cache_t* cache, unsigned long int address, int size, char op)
+{
+    int lines = 1;
+    int misses;
+
+    if(op != 'L' && op != 'S' && op != 'M')
+        return 0;
+
+    if(cache->config.split && size > 1)
+    {
+        lines = (int)(((address + size - 1) >> cache->b) - (address >> cache->b)) + 1;
+        if(lines > 1)
+            cache->stats.split_count++;
+    }
+
+    misses = AccessLines(cache, address, lines);
+    if(op == 'M')
+        misses += AccessLines(cache, address, lines);
+    return misses;
+}
+
+/*
+ * cache_access_n - Simulate n records and return the number of misses.
+ *     The set of an access a few records ahead is prefetched into the host
+ *     cache, which hides most of the lookup latency on large caches.
+ */
+unsigned long int cache_access_n(cache_t* cache, const unsigned long int* addresses, const int* sizes, const char* ops, size_t n)
+{
+    unsigned long int misses = 0;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(i + BATCH_AHEAD < n)
+            __builtin_prefetch(cache->sets[(addresses[i + BATCH_AHEAD] >> cache->b) & (cache->S - 1)]);
+        misses += cache_access(cache, addresses[i], sizes[i], ops[i]);
+    }
+    return misses;
+}
+
+void cache_stats(const cache_t* cache, cache_stats_t* stats)
+{
+    *stats = cache->stats;
+    return;
+}
+
+int cache_simulate(cache_t* cache, unsigned long int address, long int* line)
+{
+    return CacheSimulator(cache, address, line, NULL);
+}
+
+/*
+ * cache_find - Return the number of the valid line holding address, or -1.
+ */
+long int cache_find(const cache_t* cache, unsigned long int address)
+{
+    unsigned long int tag = (address >> (cache->s + cache->b));
+    unsigned long int set = (address >> cache->b) & (cache->S - 1);
+
+    for(int i = 0; i < cache->E; i++)
+    {
+        if(cache->sets[set][i].valid_bit == 1 && cache->sets[set][i].tag == tag)
+            return (long int)set * cache->E + i;
+    }
+    return -1;
+}
+
+/*
+ * cache_invalidate - Drop line number line, as a snoop from another cache
+ *     would.
+ */
+void cache_invalidate(cache_t* cache, long int line)
+{
+    Line* victim = &cache->sets[line / cache->E][line % cache->E];
+
+    victim->valid_bit = 0;
+    victim->prefetched = 0;
+    return;
+}
+
+/*
+ * Snapshot format: SNAPSHOT_MAGIC, then LEB128 varints only: the geometry
+ * and prefetcher, the counters, the prefetcher clocks, every line in set
+ * order (a flags word, and the tag and age of valid lines),
+ * the stride table or stream buffers, and the prefetch-evicted table.
+ * Signed values are zigzag-encoded.
+ */
+static void SaveVarint(FILE* out, unsigned long int value)
+{
+    while(value >= 0x80)
+    {
+        fputc((int)(value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    fputc((int)value, out);
+    return;
+}
+
+static int LoadVarint(FILE* in, unsigned long int* value)
+{
+    unsigned long int result = 0;
+    int ch;
+
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        if((ch = fgetc(in)) == EOF)
+            return -1;
+        result |= (unsigned long int)(ch & 0x7f) << shift;
+        if(!(ch & 0x80))
+        {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+#define ZIGZAG(v) (((unsigned long int)(v) << 1) ^ (unsigned long int)((long int)(v) >> 63))
+#define UNZIGZAG(v) ((long int)((v) >> 1) ^ -(long int)((v) & 1))
+
+int cache_save(const cache_t* cache, FILE* out)
+{
+    const unsigned long int* counters = (const unsigned long int*)&cache->stats;
+
+    fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LEN, out);
+    SaveVarint(out, cache->s);
+    SaveVarint(out, cache->E);
+    SaveVarint(out, cache->b);
+    SaveVarint(out, cache->config.prefetch);
+    SaveVarint(out, cache->config.prefetch_degree);
+    for(size_t i = 0; i < sizeof(cache_stats_t) / sizeof(unsigned long int); i++)
+    {
+        SaveVarint(out, counters[i]);
+    }
+    SaveVarint(out, cache->prefetch_hit);
+    SaveVarint(out, cache->stream_clock);
+
+    for(int i = 0; i < cache->S; i++)
+    {
+        for(int j = 0; j < cache->E; j++)
+        {
+            Line* line = &cache->sets[i][j];
+
+            SaveVarint(out, line->valid_bit | (line->prefetched << 1));
+            if(line->valid_bit)
+            {
+                SaveVarint(out, line->tag);
+                SaveVarint(out, line->LRU);
+            }
+        }
+    }
+
+    if(cache->config.prefetch == CACHE_PREFETCH_STRIDE)
+    {
+        for(int i = 0; i < STRIDE_ENTRIES; i++)
+        {
+            SaveVarint(out, cache->stride_table[i].region);
+            SaveVarint(out, cache->stride_table[i].last_block);
+            SaveVarint(out, ZIGZAG(cache->stride_table[i].stride));
+            SaveVarint(out, ZIGZAG(cache->stride_table[i].confidence));
+        }
+    }
+    if(cache->config.prefetch == CACHE_PREFETCH_STREAM)
+    {
+        for(int i = 0; i < cache->config.prefetch_degree; i++)
+        {
+            StreamBuffer* buffer = &cache->stream_buffers[i];
+
+            for(int k = 0; k < STREAM_DEPTH; k++)
+            {
+                SaveVarint(out, buffer->block[k]);
+            }
+            SaveVarint(out, buffer->head);
+            SaveVarint(out, buffer->count);
+            SaveVarint(out, buffer->last_use);
+        }
+    }
+
+    SaveVarint(out, cache->prefetch_evicted.used);
+    for(unsigned long int i = 0; i < cache->prefetch_evicted.size; i++)
+    {
+        if(cache->prefetch_evicted.counts[i] != 0)
+        {
+            SaveVarint(out, cache->prefetch_evicted.keys[i]);
+            SaveVarint(out, cache->prefetch_evicted.counts[i]);
+        }
+    }
+    return ferror(out) ? -1 : 0;
+}
+
+/*
+ * LoadSnapshot - Decode a snapshot into cache, which is left half-written
+ *     if it fails.
+ */
+static int LoadSnapshot(cache_t* cache, FILE* in)
+{
+    unsigned long int* counters = (unsigned long int*)&cache->stats;
+    unsigned long int value[5];
+    unsigned long int entries;
+    char magic[SNAPSHOT_MAGIC_LEN];
+
+    if(fread(magic, 1, SNAPSHOT_MAGIC_LEN, in) != SNAPSHOT_MAGIC_LEN || memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0)
+        return -1;
+    for(int i = 0; i < 5; i++)
+    {
+        if(LoadVarint(in, &value[i]) < 0)
+            return -1;
+    }
+    if(value[0] != (unsigned long int)cache->s || value[1] != (unsigned long int)cache->E || value[2] != (unsigned long int)cache->b ||
+       value[3] != (unsigned long int)cache->config.prefetch || value[4] != (unsigned long int)cache->config.prefetch_degree)
+        return -1; //taken with another geometry or prefetcher
+
+    for(size_t i = 0; i < sizeof(cache_stats_t) / sizeof(unsigned long int); i++)
+    {
+        if(LoadVarint(in, &counters[i]) < 0)
+            return -1;
+    }
+    if(LoadVarint(in, &value[0]) < 0 || LoadVarint(in, &cache->stream_clock) < 0)
+        return -1;
+    cache->prefetch_hit = (int)value[0];
+
+    for(int i = 0; i < cache->S; i++)
+    {
+        for(int j = 0; j < cache->E; j++)
+        {
+            Line* line = &cache->sets[i][j];
+
+            memset(line, 0, sizeof(Line));
+            if(LoadVarint(in, &value[0]) < 0)
+                return -1;
+            line->valid_bit = value[0] & 1;
+            line->prefetched = (value[0] >> 1) & 1;
+            if(line->valid_bit)
+            {
+                if(LoadVarint(in, &line->tag) < 0 || LoadVarint(in, &value[1]) < 0)
+                    return -1;
+                line->LRU = (int)value[1];
+            }
+        }
+    }
+
+    if(cache->config.prefetch == CACHE_PREFETCH_STRIDE)
+    {
+        for(int i = 0; i < STRIDE_ENTRIES; i++)
+        {
+            StrideEntry* entry = &cache->stride_table[i];
+
+            if(LoadVarint(in, &entry->region) < 0 || LoadVarint(in, &entry->last_block) < 0 ||
+               LoadVarint(in, &value[0]) < 0 || LoadVarint(in, &value[1]) < 0)
+                return -1;
+            entry->stride = UNZIGZAG(value[0]);
+            entry->confidence = (int)UNZIGZAG(value[1]);
+        }
+    }
+    if(cache->config.prefetch == CACHE_PREFETCH_STREAM)
+    {
+        for(int i = 0; i < cache->config.prefetch_degree; i++)
+        {
+            StreamBuffer* buffer = &cache->stream_buffers[i];
+
+            for(int k = 0; k < STREAM_DEPTH; k++)
+            {
+                if(LoadVarint(in, &buffer->block[k]) < 0)
+                    return -1;
+            }
+            if(LoadVarint(in, &value[0]) < 0 || LoadVarint(in, &value[1]) < 0 || LoadVarint(in, &buffer->last_use) < 0)
+                return -1;
+            buffer->head = (int)value[0] % STREAM_DEPTH;
+            buffer->count = (int)value[1];
+        }
+    }
+
+    cache_count_free(&cache->prefetch_evicted);
+    if(LoadVarint(in, &entries) < 0)
+        return -1;
+    for(unsigned long int i = 0; i < entries; i++)
+    {
+        if(LoadVarint(in, &value[0]) < 0 || LoadVarint(in, &value[1]) < 0)
+            return -1;
+        cache_count_add(&cache->prefetch_evicted, value[0], value[1]);
+    }
+    return 0;
+}
+
+/*
+ * cache_load - Decode into a scratch cache and swap it in only once the
+ *     whole snapshot has been read, so a failed load leaves cache as it was.
+ */
+int cache_load(cache_t* cache, FILE* in)
+{
+    cache_t* scratch = cache_create(&cache->config);
+    cache_t swap;
+
+    if(scratch == NULL)
+        return -1;
+    if(LoadSnapshot(scratch, in) < 0)
+    {
+        cache_destroy(scratch);
+        return -1;
+    }
+    swap = *cache;
+    *cache = *scratch;
+    *scratch = swap;
+    cache_destroy(scratch);
+    return 0;
+}
+
+/*
+ * Prefetchers: next-N-line and stride fill predicted lines straight into
+ * the cache as the LRU victim's replacement, marked as prefetched until a
+ * demand access uses them. Stream buffers hold their lines beside the
+ * cache and only move a line in when a demand miss finds it at a buffer
+ * head. A prefetch fill that evicts a line is remembered so a later demand
+ * miss on that line counts as pollution.
+ */
+
+/*
+ * PrefetchFill - Bring the line holding block into the cache unless it is
+ *     already there.
+ */
+static void PrefetchFill(cache_t* cache, unsigned long int block)
+{
+    unsigned long int tag = block >> cache->s;
+    unsigned long int set = block & (cache->S - 1);
+    Line* lines = cache->sets[set];
+    int victim = -1;
+    int LRU_num = -1;
+
+    for(int i = 0; i < cache->E; i++)
+    {
+        if(lines[i].valid_bit == 1 && lines[i].tag == tag)
+            return;
+    }
+
+    for(int i = 0; i < cache->E; i++)
+    {
+        if(lines[i].valid_bit == 0)
+        {
+            victim = i;
+            break;
+        }
+        if(lines[i].LRU > LRU_num)
+        {
+            LRU_num = lines[i].LRU;
+            victim = i;
+        }
+    }
+
+    if(lines[victim].valid_bit == 1)
+    {
+        unsigned long int evicted = (lines[victim].tag << cache->s) | set;
+
+        if(lines[victim].prefetched)
+            cache->stats.prefetch_useless++;
+        if(cache_count_get(&cache->prefetch_evicted, evicted) % 2 == 0)
+            cache_count_add(&cache->prefetch_evicted, evicted, 1);
+    }
+
+    for(int i = 0; i < cache->E; i++)
+    {
+        if((i != victim) && (lines[i].valid_bit == 1))
+        {
+            lines[i].LRU++;
+        }
+    }
+    lines[victim].valid_bit = 1;
+    lines[victim].tag = tag;
+    lines[victim].LRU = 0;
+    lines[victim].prefetched = 1;
+    cache->stats.prefetch_issued++;
+    return;
+}
+
+static int StreamLookup(cache_t* cache, unsigned long int block, int result)
+{
+    StreamBuffer* lru = &cache->stream_buffers[0];
+
+    cache->stream_clock++;
+    for(int i = 0; i < cache->config.prefetch_degree; i++)
+    {
+        StreamBuffer* buffer = &cache->stream_buffers[i];
+
+        if(buffer->count > 0 && buffer->block[buffer->head] == block)
+        {
+            unsigned long int next = buffer->block[(buffer->head + buffer->count - 1) % STREAM_DEPTH] + 1;
+
+            buffer->block[buffer->head] = next; //the freed slot becomes the new tail
+            buffer->head = (buffer->head + 1) % STREAM_DEPTH;
+            buffer->last_use = cache->stream_clock;
+            cache->stats.prefetch_useful++;
+            cache->stats.prefetch_issued++;
+            if(cache->config.verbose)
+                printf(" stream-hit");
+            return (result == CACHE_MISS_EVICTION) ? CACHE_HIT_EVICTION : CACHE_HIT;
+        }
+        if(buffer->last_use < lru->last_use)
+            lru = buffer;
+    }
+
+    cache->stats.prefetch_useless += lru->count; //restart the least recently used buffer
+    for(int i = 0; i < STREAM_DEPTH; i++)
+    {
+        lru->block[i] = block + 1 + i;
+    }
+    lru->head = 0;
+    lru->count = STREAM_DEPTH;
+    lru->last_use = cache->stream_clock;
+    cache->stats.prefetch_issued += STREAM_DEPTH;
+    return result;
+}
+
+static void StrideTrain(cache_t* cache, unsigned long int address)
+{
+    unsigned long int region = address >> STRIDE_REGION;
+    unsigned long int block = address >> cache->b;
+    StrideEntry* entry = &cache->stride_table[(region * 0x9e3779b97f4a7c15UL >> 32) % STRIDE_ENTRIES];
+    long int stride;
+
+    if(entry->region != region || entry->confidence < 0)
+    {
+        entry->region = region;
+        entry->last_block = block;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+
+    stride = (long int)(block - entry->last_block);
+    if(stride == 0)
+        return; //same line again, nothing to learn
+    if(stride == entry->stride)
+    {
+        if(entry->confidence < 3)
+            entry->confidence++;
+    }
+    else
+    {
+        entry->stride = stride;
+        entry->confidence = 0;
+    }
+    entry->last_block = block;
+
+    if(entry->confidence >= 2)
+    {
+        for(int i = 1; i <= cache->config.prefetch_degree; i++)
+        {
+            PrefetchFill(cache, block + entry->stride * i);
+        }
+    }
+    return;
+}
+
+/*
+ * Prefetch - Train the prefetcher on a demand access and return its result,
+ *     which a stream buffer hit turns into a hit.
+ */
+static int Prefetch(cache_t* cache, unsigned long int address, int result)
+{
+    unsigned long int block = address >> cache->b;
+    int tagged = cache->prefetch_hit;
+
+    cache->prefetch_hit = 0;
+    if(result != CACHE_HIT && cache_count_get(&cache->prefetch_evicted, block) % 2 == 1)
+    {
+        cache->stats.prefetch_pollution++;
+        cache_count_add(&cache->prefetch_evicted, block, 1);
+    }
+
+    switch(cache->config.prefetch)
+    {
+        case CACHE_PREFETCH_NEXT:
+            if(result != CACHE_HIT || tagged)
+            {
+                for(int i = 1; i <= cache->config.prefetch_degree; i++)
+                {
+                    PrefetchFill(cache, block + i);
+                }
+            }
+            break;
+        case CACHE_PREFETCH_STRIDE:
+            StrideTrain(cache, address);
+            break;
+        case CACHE_PREFETCH_STREAM:
+            if(result != CACHE_HIT)
+                result = StreamLookup(cache, block, result);
+            break;
+    }
+    return result;
+}
+
+void cache_count_add(cache_count_t* table, unsigned long int key, unsigned long int n)
+{
+    unsigned long int slot;
+
+    if(table->used * 2 >= table->size)
+    {
+        cache_count_t old = *table;
+
+        table->size = old.size ? old.size * 2 : 1024;
+        table->keys = (unsigned long int*)calloc(table->size, sizeof(unsigned long int));
+        table->counts = (unsigned long int*)calloc(table->size, sizeof(unsigned long int));
+        table->used = 0;
+        for(unsigned long int i = 0; i < old.size; i++)
+        {
+            if(old.counts[i] != 0)
+                cache_count_add(table, old.keys[i], old.counts[i]);
+        }
+        free(old.keys);
+        free(old.counts);
+    }
+
+    slot = (key * 0x9e3779b97f4a7c15UL) & (table->size - 1);
+    while(table->counts[slot] != 0 && table->keys[slot] != key)
+    {
+        slot = (slot + 1) & (table->size - 1);
+    }
+    if(table->counts[slot] == 0)
+    {
+        table->keys[slot] = key;
+        table->used++;
+    }
+    table->counts[slot] += n;
+    return;
+}
+
+unsigned long int cache_count_get(const cache_count_t* table, unsigned long int key)
+{
+    unsigned long int slot;
+
+    if(table->size == 0)
+        return 0;
+
+    slot = (key * 0x9e3779b97f4a7c15UL) & (table->size - 1);
+    while(table->counts[slot] != 0)
+    {
+        if(table->keys[slot] == key)
+            return table->counts[slot];
+        slot = (slot + 1) & (table->size - 1);
+    }
+    return 0;
+}
+
+/*
+ * cache_count_top - Fill keys/counts with the n largest entries, largest
+ *     first, and return how many were found.
+ */
+int cache_count_top(const cache_count_t* table, int n, unsigned long int* keys, unsigned long int* counts)
+{
+    int found = 0;
+
+    for(unsigned long int i = 0; i < table->size; i++)
+    {
+        int k;
+
+        if(table->counts[i] == 0)
+            continue;
+        if(found == n && table->counts[i] <= counts[n - 1])
+            continue;
+
+        k = (found < n) ? found++ : n - 1;
+        while(k > 0 && counts[k - 1] < table->counts[i])
+        {
+            keys[k] = keys[k - 1];
+            counts[k] = counts[k - 1];
+            k--;
+        }
+        keys[k] = table->keys[i];
+        counts[k] = table->counts[i];
+    }
+    return found;
+}
+
+void cache_count_free(cache_count_t* table)
+{
+    free(table->keys);
+    free(table->counts);
+    table->keys = table->counts = NULL;
+    table->size = table->used = 0;
+    return;
+}
+
+/*
+ * CacheSimulator - Look address up in its set and fill it on a miss. Only
+ *     the set is written, so the cache-wide prefetch counters are left to
+ *     the caller: *prefetched tells it the line hit, or the line evicted,
+ *     had been prefetched and not used.
+ */
+static int CacheSimulator(cache_t* cache, unsigned long int address, long int* line, int* prefetched)
+{
+    unsigned long int tag = (address >> (cache->s + cache->b));
+    unsigned long int set = ((address >> cache->b) & (cache->S - 1));
+    Line* lines = cache->sets[set];
+    int verbose_flag = cache->config.verbose;
+    int LRU_num = -1;
+    int hit_line = 0;
+    int eviction_line = 0;
+    int hit_or_not = 0;
+    int evict_or_not = 0;
+
+    //Check hits
+    for(int i = 0; i < cache->E; i++)
+    {
+        if(lines[i].valid_bit == 1)
+        {
+            if(lines[i].tag == tag)
+            {
+                hit_or_not = 1;
+                hit_line = i;
+                lines[i].LRU = 0;
+                if(prefetched != NULL)
+                    *prefetched = lines[i].prefetched;
+                lines[i].prefetched = 0;
+                break;
+            }
+        }
+    }
+    if(hit_or_not == 1)
+    {
+        for(int i = 0; i < cache->E; i++)
+        {
+            if((i != hit_line) && (lines[i].valid_bit == 1))
+            {
+                lines[i].LRU++;
+            }
+        }
+
+        if(verbose_flag)
+        {
+            printf(" hit");
+            //
+            printf("\t\t\t\tSet:%3lx, Tag: %lx", set, tag);
+            //
+        }
+        if(line != NULL)
+            *line = (long int)set * cache->E + hit_line;
+        return CACHE_HIT;
+    }
+
+    //Check misses and evictions
+    if(verbose_flag)
+    {
+        printf(" miss");
+    }
+
+    for(int i = 0; i < cache->E; i++)
+    {
+        if(lines[i].valid_bit == 0)
+        {
+            evict_or_not = -1;
+            eviction_line = i;
+            break;
+        }
+        else
+        {
+            if(lines[i].LRU > LRU_num)
+            {
+                LRU_num = lines[i].LRU;
+                evict_or_not = 1;
+                eviction_line = i;
+            }
+        }
+    }
+
+    for(int i = 0; i < cache->E; i++)
+    {
+        if((i != eviction_line) && (lines[i].valid_bit == 1))
+        {
+            lines[i].LRU++;
+        }
+    }
+
+    if(prefetched != NULL)
+        *prefetched = (evict_or_not == 1) && lines[eviction_line].prefetched;
+
+    if(evict_or_not == -1)
+    {
+        lines[eviction_line].valid_bit = 1;
+        lines[eviction_line].tag = tag;
+        lines[eviction_line].LRU = 0;
+        lines[eviction_line].prefetched = 0;
+        //
+        if(verbose_flag)
+            printf("\t\t\t");
+        //
+    }
+    else if(evict_or_not == 1)
+    {
+        if(verbose_flag)
+        {
+            printf(" eviction");
+        }
+        lines[eviction_line].tag = tag;
+        lines[eviction_line].LRU = 0;
+        lines[eviction_line].prefetched = 0;
+    }
+    //
+    if(verbose_flag)
+        printf("\tSet:%3lx, Tag: %lx", set, tag);
+    //
+    if(line != NULL)
+        *line = (long int)set * cache->E + eviction_line;
+    return (evict_or_not == 1) ? CACHE_MISS_EVICTION : CACHE_MISS;
+}
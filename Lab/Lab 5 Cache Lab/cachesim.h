@@ -0,0 +1,103 @@
+/* 20220100 Kihyun Park */
+
+/*
+ * cachesim.h - Reentrant set-associative LRU cache simulator
+ *
+ * Every cache lives in its own cache_t, so several caches can be
+ * simulated in one process and the simulator can be linked into other
+ * tools. csim is a command-line wrapper around this interface.
+ */
+#ifndef CACHESIM_H
+#define CACHESIM_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Results of a single line access */
+#define CACHE_HIT 0
+#define CACHE_MISS 1
+#define CACHE_MISS_EVICTION 2
+#define CACHE_HIT_EVICTION 3 /* stream buffer hit that still moved a line into the cache */
+
+/* Prefetcher models */
+#define CACHE_PREFETCH_NONE 0
+#define CACHE_PREFETCH_NEXT 1   /* next-N-line on misses and first use of prefetched lines */
+#define CACHE_PREFETCH_STRIDE 2 /* per-region stride detector */
+#define CACHE_PREFETCH_STREAM 3 /* stream buffers beside the cache */
+
+typedef struct //Cache geometry and options
+{
+    int s; //Number of set index bits
+    int E; //Number of lines per set
+    int b; //Number of block bits
+    int split; //split accesses into every line they touch
+    int prefetch; //CACHE_PREFETCH_*
+    int prefetch_degree; //lines per prediction, or stream buffers (0 for the default)
+    int verbose; //print hit/miss/eviction for every line access
+    void (*observer)(void* arg, unsigned long int address, int result); //called after every line access
+    void* observer_arg;
+} cache_config_t;
+
+typedef struct //Counters since creation
+{
+    unsigned long int hit_count;
+    unsigned long int miss_count;
+    unsigned long int eviction_count;
+    unsigned long int split_count;      //accesses that straddle a line boundary
+    unsigned long int split_line_count; //extra line accesses caused by them
+    unsigned long int split_miss_count; //misses on those extra lines
+    unsigned long int prefetch_issued;  //lines brought in by the prefetcher
+    unsigned long int prefetch_useful;  //prefetched lines later hit by demand accesses
+    unsigned long int prefetch_useless; //prefetched lines dropped before any use
+    unsigned long int prefetch_pollution; //demand misses on lines a prefetch evicted
+} cache_stats_t;
+
+typedef struct cache cache_t;
+
+typedef struct //Open-addressing table of per-key counts
+{
+    unsigned long int* keys;
+    unsigned long int* counts; //0 marks an empty slot
+    unsigned long int size;
+    unsigned long int used;
+} cache_count_t;
+
+/* Cache objects: cache_create returns NULL if the geometry is out of range
+   (s or b outside 0..30, E below 1, more than 2^30 lines) or memory runs out */
+cache_t* cache_create(const cache_config_t* config);
+void cache_destroy(cache_t* cache);
+const cache_config_t* cache_config(const cache_t* cache);
+
+/* Accesses: op is 'L' (load), 'S' (store) or 'M' (modify, a load then a store) */
+int cache_access(cache_t* cache, unsigned long int address, int size, char op);
+unsigned long int cache_access_n(cache_t* cache, const unsigned long int* addresses, const int* sizes, const char* ops, size_t n);
+void cache_stats(const cache_t* cache, cache_stats_t* stats);
+
+/*
+ * Low-level access to one line, without counters, prefetching or the
+ * observer. Safe to call from several threads on disjoint sets. Lines are
+ * numbered set * E + way, so a caller can keep its own per-line state
+ * (such as coherence state) in an array of S * E entries: cache_simulate
+ * stores the number of the line now holding address in *line, and
+ * cache_find returns it for a valid line, or -1.
+ */
+int cache_simulate(cache_t* cache, unsigned long int address, long int* line);
+long int cache_find(const cache_t* cache, unsigned long int address);
+void cache_invalidate(cache_t* cache, long int line);
+
+/*
+ * Snapshots of the lines, the recency order, the prefetcher tables and the
+ * counters. cache_load restores into a cache created with the same
+ * geometry and prefetcher and returns -1, leaving the cache unchanged,
+ * if the snapshot does not match or is truncated.
+ */
+int cache_save(const cache_t* cache, FILE* out);
+int cache_load(cache_t* cache, FILE* in);
+
+/* Count tables */
+void cache_count_add(cache_count_t* table, unsigned long int key, unsigned long int n);
+unsigned long int cache_count_get(const cache_count_t* table, unsigned long int key);
+int cache_count_top(const cache_count_t* table, int n, unsigned long int* keys, unsigned long int* counts);
+void cache_count_free(cache_count_t* table);
+
+#endif /* CACHESIM_H */
@@ -1,21 +1,50 @@
 /* 20220100 Kihyun Park */
 
+/*
+ * csim.c - Cache simulator driver: replays valgrind traces through
+ *     cachesim and adds the multi-core, sampling, sweep, TLB, prefetch,
+ *     profiling and checkpoint modes on top
+ *
+ * Build: gcc -g -Wall -Werror -std=c99 -o csim csim.c cachesim.c cachelab.c -lm -lpthread
+ */
+#define _GNU_SOURCE /* madvise, fdopen, pthread barriers, rand_r */
 #include "cachelab.h"
+#include "cachesim.h"
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <signal.h>
 
-typedef struct //Cache Block
-{
-    int valid_bit;
-    int tag;
-    int* block;
-    int LRU;
-} Line;
+#define BINARY_MAGIC "CSIMBIN1" //Header of the binary trace format
+#define BINARY_MAGIC_LEN 8
+#define CHECKPOINT_MAGIC "CSIMCKP1" //Header of checkpoint files
+#define CHECKPOINT_MAGIC_LEN 8
+
+#define MAX_CORES 64      //Traces in multi-core mode
+#define MESI_INVALID 0    //MESI line states
+#define MESI_SHARED 1
+#define MESI_EXCLUSIVE 2
+#define MESI_MODIFIED 3
+
+#define MAX_PAGE_SIZES 3  //TLB hierarchies simulated side by side
+#define PAGE_LEVELS 4     //radix page-table levels (PML4, PDPT, PD, PT)
+
+#define SHARD_BATCH 65536 //Records sharded per batch in parallel mode
+#define SPLIT_FLAG (1UL << 63) //Marks the extra lines of a straddling access in shard queues
+#define TOP_N 10          //Hotspots listed in reports
 
-Line** Cache; //Cache Memory
+#define STREAM_CHUNK (1 << 20) //Bytes per read() from a pipe
+#define STREAM_BATCH 4096      //Records per batch handed to the simulator
+#define STREAM_RING 8          //Batches in flight between reader and simulator
+
+cache_t* cache; //Cache Memory
 
 int opt = 0;
 int help_flag = 0;
@@ -25,22 +54,63 @@ int S = 0; //Number of sets
 unsigned int E = 0; //Number of lines per set
 int b = 0; //Number of block bits
 unsigned int B = 0; //Block size
-char* t = NULL; //trace file
+char* t = NULL; //trace file, stdin if missing or "-"
+char* c = NULL; //binary trace output file
+int j = 1; //Number of simulation threads
+char* w = NULL; //block bits to sweep, comma separated
+int split_flag = 0; //split accesses into every line they touch
+char* profile_file = NULL; //hotspot report, CSV if it ends in .csv, JSON otherwise
+int top_n = TOP_N; //hotspots listed in the report
+int prefetch_kind = CACHE_PREFETCH_NONE;
+int prefetch_degree = 0; //lines per prediction, or stream buffers
+char* m = NULL; //multi-core interleaving, "rr" or "ts"
+char* core_traces[MAX_CORES]; //every -t, one per core
+int core_count = 0;
+char* T = NULL; //page sizes for the TLB model, comma separated
+double x = 0; //fraction of sets simulated by set sampling, 0 for all
+char* y = NULL; //time sampling windows, warm:measure:skip records
+char* checkpoint_file = NULL; //state saved at the end or when interrupted
+char* resume_file = NULL; //state restored before the replay
+
+cache_stats_t stats; //hits, misses, evictions and the split/prefetch counters
 
-int hit_count = 0;
-int miss_count = 0;
-int eviction_count = 0;
+cache_count_t split_table; //straddling accesses by address
 
 void print_helpflag();
 void CacheInit();
 void DeleteCache();
+static void ObserveAccess(void* arg, unsigned long int address, int result);
 void TraceInput();
-void CacheSimulator(unsigned long int address);
+void ProcessRecord(char operation, unsigned long int address, int size, void* arg);
+void CheckpointInit();
+void WriteCheckpoint();
+void TextTraceInput(FILE* tracefile, void (*handler)(char, unsigned long int, int, void*), void* arg);
+void BinaryTraceInput(const unsigned char* data, size_t length, void (*handler)(char, unsigned long int, int, void*), void* arg);
+void StreamTraceInput(int fd, void (*handler)(char, unsigned long int, int, void*), void* arg);
+void MultiCore();
+int IsStream(const char* path);
+void ForEachRecord(const char* path, void (*handler)(char, unsigned long int, int, void*), void* arg);
+void ConvertTrace(const char* input, const char* output);
+void ParallelTraceInput();
+void Sweep();
+void Sample();
+int SplitLines(unsigned long int address, int size);
+void PrintSplitSummary();
+void ProfileInit();
+void ProfileAccess(unsigned long int address, int result);
+void WriteProfile();
+void PrefetchInit(char* spec);
+void PrintPrefetchSummary();
+void TlbInit(char* spec);
+void TlbAccess(unsigned long int address);
+void PrintTlbSummary();
 
 int main(int argc, char* argv[])
 {
+    int parallel;
+
     //Parse command-line arguments
-    while((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1)
+    while((opt = getopt(argc, argv, "hvas:E:b:t:c:j:w:p:n:f:m:T:x:y:k:r:")) != -1)
     {
         switch(opt)
         {
@@ -50,6 +120,9 @@ int main(int argc, char* argv[])
             case 'v':
                 verbose_flag = 1;
                 break;
+            case 'a':
+                split_flag = 1;
+                break;
             case 's':
                 s = atoi(optarg);
                 S = (unsigned)pow(2, s);
@@ -63,24 +136,125 @@ int main(int argc, char* argv[])
                 break;
             case 't':
                 t = optarg;
+                if(core_count < MAX_CORES)
+                    core_traces[core_count++] = optarg;
+                break;
+            case 'c':
+                c = optarg;
+                break;
+            case 'j':
+                j = atoi(optarg);
+                break;
+            case 'w':
+                w = optarg;
+                break;
+            case 'p':
+                profile_file = optarg;
+                break;
+            case 'n':
+                top_n = atoi(optarg);
+                break;
+            case 'f':
+                PrefetchInit(optarg);
+                break;
+            case 'm':
+                m = optarg;
+                break;
+            case 'T':
+                T = optarg;
+                break;
+            case 'x':
+                x = atof(optarg);
+                break;
+            case 'y':
+                y = optarg;
+                break;
+            case 'k':
+                checkpoint_file = optarg;
+                break;
+            case 'r':
+                resume_file = optarg;
                 break;
         }
     }
 
     //Print usage info
     print_helpflag();
+
+    //Checkpoints cover the single serial cache only
+    if((checkpoint_file != NULL || resume_file != NULL) && (w != NULL || m != NULL || x != 0 || y != NULL || j > 1))
+    {
+        fprintf(stderr, "Checkpoints do not support -w, -m, -x, -y or -j\n");
+        return 1;
+    }
+
+    //Convert the text trace to the binary format and exit
+    if(c != NULL)
+    {
+        ConvertTrace(t, c);
+        return 0;
+    }
+
+    //Miss-ratio curves for every s <= -s and E <= -E in one pass
+    if(w != NULL)
+    {
+        Sweep();
+        return 0;
+    }
+
+    //One coherent private cache per trace
+    if(m != NULL)
+    {
+        MultiCore();
+        return 0;
+    }
+
+    //Estimated rates from a sample of the sets and/or of the trace
+    if(x != 0 || y != NULL)
+    {
+        CacheInit();
+        Sample();
+        DeleteCache();
+        return 0;
+    }
     
     //Cache Init
+    //profiling, prefetchers, TLBs and checkpoints need the global access order
+    parallel = (j > 1 && profile_file == NULL && prefetch_kind == CACHE_PREFETCH_NONE && T == NULL &&
+                checkpoint_file == NULL && resume_file == NULL);
+    if(parallel)
+        verbose_flag = 0; //per-access output has no order across threads
     CacheInit();
+    if(T != NULL)
+        TlbInit(T);
+    if(checkpoint_file != NULL || resume_file != NULL)
+        CheckpointInit();
 
     //Tracefile Input
-    TraceInput();
+    if(profile_file != NULL)
+    {
+        ProfileInit();
+        TraceInput(); //miss classification needs the global access order
+        WriteProfile();
+    }
+    else if(parallel)
+        ParallelTraceInput();
+    else
+        TraceInput();
+    if(checkpoint_file != NULL)
+        WriteCheckpoint();
 
     //Delete Cache
     DeleteCache();
 
     //Print Results
-    printSummary(hit_count, miss_count, eviction_count);
+    printSummary(stats.hit_count, stats.miss_count, stats.eviction_count);
+    if(split_flag)
+        PrintSplitSummary();
+    if(prefetch_kind != CACHE_PREFETCH_NONE)
+        PrintPrefetchSummary();
+    if(T != NULL)
+        PrintTlbSummary();
     return 0;
 }
 
@@ -88,187 +262,2160 @@ void print_helpflag()
 {
     if(help_flag)
     {
-        printf("\nUsage: ./csim-ref [-hv] -s <s> -E <E> -b <b> -t <tracefile>\n");
+        printf("\nUsage: ./csim-ref [-hva] -s <s> -E <E> -b <b> -t <tracefile> [-j <threads>] [-k <file>] [-r <file>]\n");
+        printf("       ./csim-ref -t <tracefile> -c <binaryfile>\n");
+        printf("       ./csim-ref -w <b,b,...> -s <max s> -E <max E> -t <tracefile>\n");
+        printf("       ./csim-ref -m <rr|ts> -s <s> -E <E> -b <b> -t <trace0> -t <trace1> ...\n");
+        printf("       ./csim-ref [-x <fraction>] [-y <warm:measure:skip>] -s <s> -E <E> -b <b> -t <tracefile>\n");
         printf("  -h: Optional help flag that prints usage info\n");
         printf("  -v: Optional verbose flag that displays trace info\n");
+        printf("  -a: Optional flag that splits accesses into every line they touch\n");
         printf("  -s <s>: Number of set index bits (S = 2^s is the number of sets)\n");
         printf("  -E <E>: Associativity (number of lines per set)\n");
         printf("  -b <b>: Number of block bits (B = 2^b is the block size)\n");
-        printf("  -t <tracefile>: Name of the valgrind trace to replay\n\n");
+        printf("  -t <tracefile>: Name of the valgrind trace to replay (text or binary), \"-\" or none for stdin\n");
+        printf("  -c <binaryfile>: Convert the text trace to the binary format and exit\n");
+        printf("  -j <threads>: Simulate disjoint groups of sets on this many threads\n");
+        printf("  -p <file>: Write per-set heatmaps, top missing lines/addresses and 3C miss classes (.csv or JSON)\n");
+        printf("  -n <N>: Number of hotspots listed by -p (default %d)\n", TOP_N);
+        printf("  -f <next|stride|stream>[:N]: Enable a prefetcher with degree N (lines, or stream buffers)\n");
+        printf("  -m <rr|ts>: Simulate one MESI-coherent cache per trace, interleaved round-robin or by timestamp\n");
+        printf("  -T <4k,2m,1g>: Also simulate DTLB, STLB and page walks for each listed page size\n");
+        printf("  -x <fraction>: Simulate only this fraction of the sets (hashed) and estimate the rates\n");
+        printf("  -y <warm:measure:skip>: Simulate in windows of warm-up, measured and skipped records\n");
+        printf("  -k <file>: Save the cache state at the end of the trace, or on SIGINT/SIGTERM\n");
+        printf("  -r <file>: Restore the cache state first; an interrupted run resumes where it stopped\n");
+        printf("  -w <b,b,...>: Print CSV miss-ratio curves for every s and E up to -s/-E, one thread per block size\n\n");
     }
     return;
 }
 
 void CacheInit()
 {
-    Cache = (Line**)malloc(sizeof(Line*) * S);
-    for(int i = 0; i < S; i++)
+    cache_config_t config;
+
+    memset(&config, 0, sizeof(config));
+    config.s = s;
+    config.E = E;
+    config.b = b;
+    config.split = split_flag;
+    config.prefetch = prefetch_kind;
+    config.prefetch_degree = prefetch_degree;
+    config.verbose = verbose_flag;
+    if(T != NULL || profile_file != NULL)
+        config.observer = ObserveAccess;
+
+    if((cache = cache_create(&config)) == NULL)
     {
-        Cache[i] = (Line*)malloc(sizeof(Line) * E);
-        for(int j = 0; j < E; j++)
-        {
-            Cache[i][j].valid_bit = 0;
-            Cache[i][j].tag = 0;
-            Cache[i][j].block = (int*)malloc(sizeof(int) * B);
-            Cache[i][j].LRU = 0;
-        }
+        fprintf(stderr, "Invalid cache geometry\n");
+        exit(1);
     }
     return;
 }
 
 void DeleteCache()
 {
-    for(int i = 0; i < S; i++)
-    {
-        for(int j = 0; j < E; j++)
-        {
-            free(Cache[i][j].block);
-        }
-        free(Cache[i]);
-    }
-    free(Cache);
+    cache_destroy(cache);
     return;
 }
 
 void TraceInput()
 {
-    FILE* tracefile;
+    ForEachRecord(t, ProcessRecord, NULL);
+    cache_stats(cache, &stats);
+    return;
+}
 
-    char operation = NULL;
-    unsigned long int address = 0;
-    int size = 0;
+/*
+ * ObserveAccess - Feed every line access of the cache to the TLB model
+ *     and the profiler.
+ */
+static void ObserveAccess(void* arg, unsigned long int address, int result)
+{
+    if(T != NULL)
+        TlbAccess(address);
+    if(profile_file != NULL)
+        ProfileAccess(address, result);
+    return;
+}
 
-    tracefile = fopen(t, "r");
-    while(fscanf(tracefile, " %c %lx, %d", &operation, &address, &size) != EOF)
+/*
+ * Checkpoints: -k writes the cache state (see cache_save) and the split
+ * hotspots behind a small header holding the number of trace records
+ * consumed and whether the run was cut short by SIGINT/SIGTERM. -r restores it; a checkpoint of an
+ * interrupted run also skips the records it already consumed, so rerunning
+ * the same command resumes it, while a complete one just warms the cache
+ * for whatever trace follows. The file is written under a temporary name
+ * and renamed, so a preempted save never leaves half a checkpoint.
+ */
+typedef struct //Checkpoint header
+{
+    char magic[CHECKPOINT_MAGIC_LEN];
+    unsigned long int records; //trace records consumed
+    int interrupted;
+} CheckpointHeader;
+
+static volatile sig_atomic_t interrupted = 0;
+static unsigned long int records_done = 0;
+static unsigned long int resume_skip = 0;
+
+static void CheckpointHandler(int sig)
+{
+    interrupted = 1;
+    return;
+}
+
+void CheckpointInit()
+{
+    if(T != NULL || profile_file != NULL)
     {
-        if(verbose_flag)
+        fprintf(stderr, "Checkpoints do not support -T or -p\n");
+        exit(1);
+    }
+    if(resume_file != NULL)
+    {
+        CheckpointHeader header;
+        FILE* in = fopen(resume_file, "rb");
+        unsigned long int entries = 0;
+        unsigned long int entry[2];
+
+        if(in == NULL)
         {
-            printf("%c %lx,%d", operation, address, size);
+            fprintf(stderr, "%s: No such file\n", resume_file);
+            exit(1);
         }
-
-        switch(operation)
+        if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0 ||
+           cache_load(cache, in) < 0 || fread(&entries, sizeof(entries), 1, in) != 1)
         {
-            case 'L':
-                CacheSimulator(address);
-                break;
-            case 'M':
-                CacheSimulator(address);
-                CacheSimulator(address);
-                break;
-            case 'S':
-                CacheSimulator(address);
-                break;
+            fprintf(stderr, "%s: Not a checkpoint of this cache (-s/-E/-b/-f)\n", resume_file);
+            exit(1);
         }
-
-        if(verbose_flag)
+        for(unsigned long int i = 0; i < entries && fread(entry, sizeof(entry), 1, in) == 1; i++)
         {
-            printf("\n");
+            cache_count_add(&split_table, entry[0], entry[1]);
         }
+        fclose(in);
+        if(header.interrupted)
+            resume_skip = header.records; //records of this trace, consumed again below
+    }
+
+    if(checkpoint_file != NULL)
+    {
+        signal(SIGINT, CheckpointHandler);
+        signal(SIGTERM, CheckpointHandler);
     }
-    fclose(tracefile);
     return;
 }
 
-void CacheSimulator(unsigned long int address)
+void WriteCheckpoint()
 {
-    unsigned long int tag = (address >> (s + b));
-    unsigned long int set = ((address >> b) & (S - 1));
-    int LRU_num = -1;
-    int hit_line = 0;
-    int eviction_line = 0;
-    int hit_or_not = 0;
-    int evict_or_not = 0;
+    CheckpointHeader header;
+    char* temp = (char*)malloc(strlen(checkpoint_file) + 5);
+    FILE* out;
 
-    //Check hits
-    for(int i = 0; i < E; i++)
+    sprintf(temp, "%s.tmp", checkpoint_file);
+    if((out = fopen(temp, "wb")) == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open output file\n", temp);
+        exit(1);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN);
+    header.records = records_done;
+    header.interrupted = interrupted;
+    fwrite(&header, sizeof(header), 1, out);
+    cache_save(cache, out);
+    fwrite(&split_table.used, sizeof(split_table.used), 1, out);
+    for(unsigned long int i = 0; i < split_table.size; i++)
     {
-        if(Cache[set][i].valid_bit == 1)
+        if(split_table.counts[i] != 0)
         {
-            if(Cache[set][i].tag == tag)
-            {
-                hit_or_not = 1;
-                hit_line = i;
-                Cache[set][i].LRU = 0;
-                break;
-            }
+            fwrite(&split_table.keys[i], sizeof(unsigned long int), 1, out);
+            fwrite(&split_table.counts[i], sizeof(unsigned long int), 1, out);
         }
     }
-    if(hit_or_not == 1)
+    if(ferror(out) || fclose(out) != 0 || rename(temp, checkpoint_file) != 0)
+    {
+        fprintf(stderr, "%s: Cannot write checkpoint\n", checkpoint_file);
+        exit(1);
+    }
+    free(temp);
+    return;
+}
+
+void ProcessRecord(char operation, unsigned long int address, int size, void* arg)
+{
+    if(records_done < resume_skip)
+    {
+        records_done++;
+        return; //simulated before the checkpoint
+    }
+    if(interrupted)
+    {
+        WriteCheckpoint();
+        fprintf(stderr, "Interrupted after %lu records, state saved to %s\n", records_done, checkpoint_file);
+        exit(1);
+    }
+    records_done++;
+
+    if(verbose_flag)
+    {
+        printf("%c %lx,%d", operation, address, size);
+    }
+
+    if(split_flag && (operation == 'L' || operation == 'S' || operation == 'M'))
+        SplitLines(address, size); //only records the hotspot, the cache counts the split
+
+    cache_access(cache, address, size, operation);
+
+    if(verbose_flag)
+    {
+        printf("\n");
+    }
+    return;
+}
+
+/*
+ * Binary trace format: the 8-byte BINARY_MAGIC header followed by one
+ * record per access. Each record is a tag byte holding the operation in
+ * the low 2 bits (L, S, M, I) and the size in the high 6 bits (0 means
+ * the size follows as a varint), then the zigzag-encoded difference to
+ * the previous address as a LEB128 varint.
+ */
+static const char binary_ops[4] = {'L', 'S', 'M', 'I'};
+
+static int BinaryOpCode(char operation)
+{
+    switch(operation)
+    {
+        case 'L':
+            return 0;
+        case 'S':
+            return 1;
+        case 'M':
+            return 2;
+        case 'I':
+            return 3;
+    }
+    return -1;
+}
+
+static void PutVarint(FILE* out, unsigned long int value)
+{
+    while(value >= 0x80)
+    {
+        fputc((int)(value & 0x7f) | 0x80, out);
+        value >>= 7;
+    }
+    fputc((int)value, out);
+    return;
+}
+
+static const unsigned char* GetVarint(const unsigned char* p, const unsigned char* end, unsigned long int* value)
+{
+    unsigned long int result = 0;
+    int shift = 0;
+
+    while(p < end && shift < 64)
     {
-        for(int i = 0; i < E; i++)
+        unsigned char byte = *p++;
+        result |= (unsigned long int)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
         {
-            if((i != hit_line) && (Cache[set][i].valid_bit == 1))
-            {
-                Cache[set][i].LRU++;
-            }
+            *value = result;
+            return p;
         }
+        shift += 7;
+    }
+    return NULL; //truncated record
+}
+
+void TextTraceInput(FILE* tracefile, void (*handler)(char, unsigned long int, int, void*), void* arg)
+{
+    char operation = 0;
+    unsigned long int address = 0;
+    int size = 0;
+
+    while(fscanf(tracefile, " %c %lx, %d", &operation, &address, &size) != EOF)
+    {
+        handler(operation, address, size, arg);
+    }
+    return;
+}
+
+void BinaryTraceInput(const unsigned char* data, size_t length, void (*handler)(char, unsigned long int, int, void*), void* arg)
+{
+    const unsigned char* p = data + BINARY_MAGIC_LEN;
+    const unsigned char* end = data + length;
+    unsigned long int address = 0;
+    unsigned long int delta = 0;
+    unsigned long int size = 0;
+
+    while(p < end)
+    {
+        unsigned char tag = *p++;
+
+        size = tag >> 2;
+        if(size == 0 && (p = GetVarint(p, end, &size)) == NULL)
+            break;
+        if((p = GetVarint(p, end, &delta)) == NULL)
+            break;
+        address += (delta >> 1) ^ -(delta & 1); //undo zigzag encoding
+
+        handler(binary_ops[tag & 3], address, (int)size, arg);
+    }
+    return;
+}
+
+/*
+ * Streaming input: pipes, FIFOs and stdin can be neither mapped nor
+ * rewound, so a reader thread read()s large chunks, parses them (text
+ * lines, or the binary format if the stream starts with its header) into
+ * fixed-size record batches and passes them through a ring of STREAM_RING
+ * batches. Parsing overlaps simulation and memory stays constant however
+ * long the trace is; lines that are not records, such as valgrind's
+ * "==pid==" messages, are skipped. A text record may start with a decimal
+ * timestamp, used to interleave per-thread traces; records without one
+ * are stamped with their position in the trace.
+ */
+typedef struct //Parsed records handed from the reader thread
+{
+    char operation[STREAM_BATCH];
+    unsigned long int address[STREAM_BATCH];
+    int size[STREAM_BATCH];
+    unsigned long int timestamp[STREAM_BATCH];
+    int length;
+} RecordBatch;
+
+typedef struct //Reader thread and batch ring of one stream
+{
+    pthread_t thread;
+    int fd;
+    RecordBatch ring[STREAM_RING];
+    int head;   //next batch to simulate
+    int count;  //batches ready
+    int eof;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    RecordBatch* current; //batch being consumed by StreamNext
+    int index;
+} TraceStream;
+
+static int IsHex(unsigned char ch)
+{
+    return (ch >= '0' && ch <= '9') || ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f');
+}
+
+/*
+ * ParseTextLine - Parse one " <op> <hexaddr>,<size>" line ending before
+ *     end and return 1 if it is an access record.
+ */
+static int ParseTextLine(const char* p, const char* end, char* operation, unsigned long int* address, int* size, unsigned long int* timestamp)
+{
+    unsigned long int value = 0;
+    int length = 0;
+
+    while(p < end && *p == ' ')
+    {
+        p++;
+    }
+    if(p < end && *p >= '0' && *p <= '9') //optional timestamp
+    {
+        unsigned long int stamp = 0;
 
-        hit_count++;
-        if(verbose_flag)
+        while(p < end && *p >= '0' && *p <= '9')
         {
-            printf(" hit");
-            //
-            printf("\t\t\t\tSet:%3lx, Tag: %lx", set, tag);
-            //
+            stamp = stamp * 10 + (*p - '0');
+            p++;
         }
-        return;
+        *timestamp = stamp;
+        while(p < end && *p == ' ')
+        {
+            p++;
+        }
+    }
+    if(p + 1 >= end || (*p != 'L' && *p != 'S' && *p != 'M' && *p != 'I') || p[1] != ' ')
+        return 0;
+    *operation = *p;
+    p += 2;
+    while(p < end && *p == ' ')
+    {
+        p++;
+    }
+    if(p == end || !IsHex(*p))
+        return 0;
+    while(p < end && IsHex(*p))
+    {
+        value = (value << 4) | ((*p <= '9') ? (unsigned long int)(*p - '0') : (unsigned long int)((*p | 0x20) - 'a' + 10));
+        p++;
+    }
+    if(p == end || *p != ',')
+        return 0;
+    p++;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+        length = length * 10 + (*p - '0');
+        p++;
     }
+    *address = value;
+    *size = length;
+    return 1;
+}
 
-    //Check misses and evictions
-    miss_count++;
-    if(verbose_flag)
+static RecordBatch* StreamFreeBatch(TraceStream* stream)
+{
+    RecordBatch* batch;
+
+    pthread_mutex_lock(&stream->lock);
+    while(stream->count == STREAM_RING)
     {
-        printf(" miss");
+        pthread_cond_wait(&stream->not_full, &stream->lock);
     }
+    batch = &stream->ring[(stream->head + stream->count) % STREAM_RING];
+    pthread_mutex_unlock(&stream->lock);
+    batch->length = 0;
+    return batch;
+}
+
+static void StreamPublish(TraceStream* stream, int eof)
+{
+    pthread_mutex_lock(&stream->lock);
+    if(!eof)
+        stream->count++;
+    stream->eof = eof;
+    pthread_cond_signal(&stream->not_empty);
+    pthread_mutex_unlock(&stream->lock);
+    return;
+}
+
+static void* StreamReader(void* arg)
+{
+    TraceStream* stream = (TraceStream*)arg;
+    char* buf = (char*)malloc(STREAM_CHUNK);
+    RecordBatch* batch = StreamFreeBatch(stream);
+    unsigned long int prev_address = 0;
+    unsigned long int records = 0;
+    size_t carry = 0;
+    int binary = -1; //unknown until the first bytes arrive
+    int done = 0;
 
-    for(int i = 0; i < E; i++)
+    while(!done)
     {
-        if(Cache[set][i].valid_bit == 0)
-        {
-            evict_or_not = -1;
-            eviction_line = i;
+        ssize_t n = read(stream->fd, buf + carry, STREAM_CHUNK - carry);
+        const char* p = buf;
+        const char* end;
+
+        if(n < 0)
             break;
+        done = (n == 0);
+        end = buf + carry + n;
+
+        if(binary < 0 && (end - p >= BINARY_MAGIC_LEN || done))
+        {
+            binary = (end - p >= BINARY_MAGIC_LEN && memcmp(p, BINARY_MAGIC, BINARY_MAGIC_LEN) == 0);
+            if(binary)
+                p += BINARY_MAGIC_LEN;
         }
-        else
+
+        while(binary >= 0 && p < end)
         {
-            if(Cache[set][i].LRU > LRU_num)
+            int i = batch->length;
+
+            if(binary)
+            {
+                const unsigned char* q = (const unsigned char*)p;
+                unsigned char tag = *q++;
+                unsigned long int size = tag >> 2;
+                unsigned long int delta;
+
+                if(size == 0 && (q = GetVarint(q, (const unsigned char*)end, &size)) == NULL)
+                    break; //record continues in the next chunk
+                if((q = GetVarint(q, (const unsigned char*)end, &delta)) == NULL)
+                    break;
+                prev_address += (delta >> 1) ^ -(delta & 1);
+                batch->operation[i] = binary_ops[tag & 3];
+                batch->address[i] = prev_address;
+                batch->size[i] = (int)size;
+                batch->timestamp[i] = records++;
+                batch->length++;
+                p = (const char*)q;
+            }
+            else
+            {
+                const char* eol = memchr(p, '\n', end - p);
+
+                if(eol == NULL)
+                {
+                    if(!done)
+                        break; //line continues in the next chunk
+                    eol = end;
+                }
+                batch->timestamp[i] = records;
+                if(ParseTextLine(p, eol, &batch->operation[i], &batch->address[i], &batch->size[i], &batch->timestamp[i]))
+                {
+                    batch->length++;
+                    records++;
+                }
+                p = (eol < end) ? eol + 1 : eol;
+            }
+
+            if(batch->length == STREAM_BATCH)
             {
-                LRU_num = Cache[set][i].LRU;
-                evict_or_not = 1;
-                eviction_line = i;
+                StreamPublish(stream, 0);
+                batch = StreamFreeBatch(stream);
             }
         }
+
+        carry = end - p;
+        memmove(buf, p, carry);
+        if(carry == STREAM_CHUNK) //a single line longer than the chunk
+            carry = 0;
+    }
+
+    if(batch->length > 0)
+    {
+        StreamPublish(stream, 0);
+    }
+    StreamPublish(stream, 1);
+    free(buf);
+    return NULL;
+}
+
+static TraceStream* StreamOpen(int fd)
+{
+    TraceStream* stream = (TraceStream*)calloc(1, sizeof(TraceStream));
+
+    stream->fd = fd;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->not_empty, NULL);
+    pthread_cond_init(&stream->not_full, NULL);
+    pthread_create(&stream->thread, NULL, StreamReader, stream);
+    return stream;
+}
+
+/*
+ * StreamNextBatch - Return the next batch of records, releasing the previous
+ *     one back to the reader, or NULL at the end of the input.
+ */
+static RecordBatch* StreamNextBatch(TraceStream* stream)
+{
+    RecordBatch* batch;
+
+    pthread_mutex_lock(&stream->lock);
+    if(stream->current != NULL)
+    {
+        stream->head = (stream->head + 1) % STREAM_RING;
+        stream->count--;
+        pthread_cond_signal(&stream->not_full);
     }
+    while(stream->count == 0 && !stream->eof)
+    {
+        pthread_cond_wait(&stream->not_empty, &stream->lock);
+    }
+    batch = (stream->count == 0) ? NULL : &stream->ring[stream->head];
+    pthread_mutex_unlock(&stream->lock);
+
+    stream->current = batch;
+    stream->index = 0;
+    return batch;
+}
+
+/*
+ * StreamNext - Pull one record and return 0 at the end of the input.
+ */
+static int StreamNext(TraceStream* stream, char* operation, unsigned long int* address, int* size, unsigned long int* timestamp)
+{
+    RecordBatch* batch = stream->current;
+
+    while(batch == NULL || stream->index == batch->length)
+    {
+        if((batch = StreamNextBatch(stream)) == NULL)
+            return 0;
+    }
+    *operation = batch->operation[stream->index];
+    *address = batch->address[stream->index];
+    *size = batch->size[stream->index];
+    *timestamp = batch->timestamp[stream->index];
+    stream->index++;
+    return 1;
+}
+
+static void StreamClose(TraceStream* stream)
+{
+    while(StreamNextBatch(stream) != NULL) //drain so the reader can finish
+        ;
+    pthread_join(stream->thread, NULL);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->not_empty);
+    pthread_cond_destroy(&stream->not_full);
+    free(stream);
+    return;
+}
+
+void StreamTraceInput(int fd, void (*handler)(char, unsigned long int, int, void*), void* arg)
+{
+    TraceStream* stream = StreamOpen(fd);
+    RecordBatch* batch;
 
-    for(int i = 0; i < E; i++)
+    while((batch = StreamNextBatch(stream)) != NULL)
     {
-        if((i != eviction_line) && (Cache[set][i].valid_bit == 1))
+        for(int i = 0; i < batch->length; i++)
         {
-            Cache[set][i].LRU++;
+            handler(batch->operation[i], batch->address[i], batch->size[i], arg);
         }
     }
+    StreamClose(stream);
+    return;
+}
+
+/*
+ * IsStream - Return 1 if the trace can only be read once (stdin, a pipe or
+ *     a FIFO).
+ */
+int IsStream(const char* path)
+{
+    struct stat st;
+
+    if(path == NULL || strcmp(path, "-") == 0)
+        return 1;
+    return stat(path, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+/*
+ * ForEachRecord - Replay every record of a trace through handler. Binary
+ *     traces are recognized by their header and read zero-copy via mmap,
+ *     pipes and FIFOs go through the streaming reader, and other files
+ *     through the text parser.
+ */
+void ForEachRecord(const char* path, void (*handler)(char, unsigned long int, int, void*), void* arg)
+{
+    FILE* tracefile;
+    struct stat st;
+    int fd;
+    unsigned char* data;
+
+    if(path == NULL || strcmp(path, "-") == 0)
+    {
+        StreamTraceInput(STDIN_FILENO, handler, arg);
+        return;
+    }
+
+    if((fd = open(path, O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "%s: No such file\n", path);
+        exit(1);
+    }
 
-    if(evict_or_not == -1)
+    if(fstat(fd, &st) == 0 && !S_ISREG(st.st_mode))
     {
-        Cache[set][eviction_line].valid_bit = 1;
-        Cache[set][eviction_line].tag = tag;
-        Cache[set][eviction_line].LRU = 0;
-        //
-        printf("\t\t\t");
-        //
+        StreamTraceInput(fd, handler, arg);
+        close(fd);
+        return;
     }
-    else if(evict_or_not == 1)
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= BINARY_MAGIC_LEN)
     {
-        eviction_count++;
-        if(verbose_flag)
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED)
         {
-            printf(" eviction");
+            if(memcmp(data, BINARY_MAGIC, BINARY_MAGIC_LEN) == 0)
+            {
+                madvise(data, st.st_size, MADV_SEQUENTIAL);
+                BinaryTraceInput(data, st.st_size, handler, arg);
+                munmap(data, st.st_size);
+                close(fd);
+                return;
+            }
+            munmap(data, st.st_size);
         }
-        Cache[set][eviction_line].tag = tag;
-        Cache[set][eviction_line].LRU = 0;
     }
-    //
-    printf("\tSet:%3lx, Tag: %lx", set, tag);
-    //
+
+    tracefile = fdopen(fd, "r");
+    TextTraceInput(tracefile, handler, arg);
+    fclose(tracefile);
     return;
-}
\ No newline at end of file
+}
+
+typedef struct //State of the text to binary conversion
+{
+    FILE* out;
+    unsigned long int prev_address;
+} Converter;
+
+static void ConvertRecord(char operation, unsigned long int address, int size, void* arg)
+{
+    Converter* conv = (Converter*)arg;
+    unsigned long int delta = address - conv->prev_address;
+    int code = BinaryOpCode(operation);
+
+    if(code < 0)
+        return; //not a memory access
+
+    if(size > 0 && size < 64)
+    {
+        fputc((size << 2) | code, conv->out);
+    }
+    else
+    {
+        fputc(code, conv->out);
+        PutVarint(conv->out, (unsigned long int)size);
+    }
+    PutVarint(conv->out, (delta << 1) ^ -(delta >> 63)); //zigzag keeps small negative deltas short
+    conv->prev_address = address;
+    return;
+}
+
+void ConvertTrace(const char* input, const char* output)
+{
+    Converter conv;
+
+    if((conv.out = fopen(output, "wb")) == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open output file\n", output);
+        exit(1);
+    }
+    conv.prev_address = 0;
+
+    fwrite(BINARY_MAGIC, 1, BINARY_MAGIC_LEN, conv.out);
+    ForEachRecord(input, ConvertRecord, &conv);
+    fclose(conv.out);
+    return;
+}
+
+/*
+ * Parallel mode: sets never interact, so the reader shards every access by
+ * set index into per-thread queues and each worker replays only its own
+ * sets. Queues are double-buffered; a barrier per batch hands the filled
+ * buffers over while the reader goes on filling the other half.
+ */
+typedef struct //Per-thread shard of the simulation
+{
+    pthread_t thread;
+    unsigned long int* queue[2]; //addresses of the current and next batch
+    int length[2];
+    int capacity[2];
+    int hit_count;
+    int miss_count;
+    int eviction_count;
+    int split_miss_count;
+} Worker;
+
+static Worker* workers;
+static pthread_barrier_t batch_barrier;
+static int fill_buffer = 0;
+static int batch_length = 0;
+
+static void ShardAccess(unsigned long int address)
+{
+    Worker* worker = &workers[((address >> b) & (S - 1)) % j];
+    int buf = fill_buffer;
+
+    if(worker->length[buf] == worker->capacity[buf])
+    {
+        worker->capacity[buf] = worker->capacity[buf] ? worker->capacity[buf] * 2 : 1024;
+        worker->queue[buf] = (unsigned long int*)realloc(worker->queue[buf], sizeof(unsigned long int) * worker->capacity[buf]);
+    }
+    worker->queue[buf][worker->length[buf]++] = address;
+    batch_length++;
+    return;
+}
+
+static void DispatchBatch()
+{
+    pthread_barrier_wait(&batch_barrier); //workers finished the other buffer
+    fill_buffer ^= 1;
+    for(int i = 0; i < j; i++)
+    {
+        workers[i].length[fill_buffer] = 0;
+    }
+    batch_length = 0;
+    return;
+}
+
+static void ShardLines(unsigned long int address, int lines)
+{
+    ShardAccess(address);
+    for(int i = 1; i < lines; i++)
+    {
+        ShardAccess((((address >> b) + i) << b) | SPLIT_FLAG);
+        stats.split_line_count++;
+    }
+    return;
+}
+
+static void ShardRecord(char operation, unsigned long int address, int size, void* arg)
+{
+    int lines = 1;
+
+    if(split_flag && (operation == 'L' || operation == 'S' || operation == 'M'))
+        lines = SplitLines(address, size);
+    if(lines > 1)
+        stats.split_count++;
+
+    switch(operation)
+    {
+        case 'M':
+            ShardLines(address, lines);
+            ShardLines(address, lines);
+            break;
+        case 'L':
+        case 'S':
+            ShardLines(address, lines);
+            break;
+    }
+
+    if(batch_length >= SHARD_BATCH)
+        DispatchBatch();
+    return;
+}
+
+static void* SimulateShard(void* arg)
+{
+    Worker* worker = (Worker*)arg;
+    int buf = 0;
+
+    while(1)
+    {
+        pthread_barrier_wait(&batch_barrier);
+        if(worker->length[buf] < 0)
+            break; //end of trace
+
+        for(int i = 0; i < worker->length[buf]; i++)
+        {
+            unsigned long int address = worker->queue[buf][i];
+
+            switch(cache_simulate(cache, address & ~SPLIT_FLAG, NULL))
+            {
+                case CACHE_HIT:
+                    worker->hit_count++;
+                    break;
+                case CACHE_MISS_EVICTION:
+                    worker->eviction_count++;
+                    /* fall through */
+                case CACHE_MISS:
+                    worker->miss_count++;
+                    if(address & SPLIT_FLAG)
+                        worker->split_miss_count++;
+                    break;
+            }
+        }
+        buf ^= 1;
+    }
+    return NULL;
+}
+
+void ParallelTraceInput()
+{
+    workers = (Worker*)calloc(j, sizeof(Worker));
+    pthread_barrier_init(&batch_barrier, NULL, j + 1);
+    for(int i = 0; i < j; i++)
+    {
+        pthread_create(&workers[i].thread, NULL, SimulateShard, &workers[i]);
+    }
+
+    ForEachRecord(t, ShardRecord, NULL);
+    DispatchBatch();    //hand over the last partial batch
+    for(int i = 0; i < j; i++)
+    {
+        workers[i].length[fill_buffer] = -1;
+    }
+    pthread_barrier_wait(&batch_barrier);
+
+    for(int i = 0; i < j; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        stats.hit_count += workers[i].hit_count;
+        stats.miss_count += workers[i].miss_count;
+        stats.eviction_count += workers[i].eviction_count;
+        stats.split_miss_count += workers[i].split_miss_count;
+        free(workers[i].queue[0]);
+        free(workers[i].queue[1]);
+    }
+    pthread_barrier_destroy(&batch_barrier);
+    free(workers);
+    return;
+}
+
+/*
+ * Sweep mode: Mattson stack distances give the LRU result of every
+ * associativity at once, since an access hits in an E-way set exactly when
+ * fewer than E other blocks of that set were touched since its last use.
+ * For each number of set bits every set keeps a treap of its resident
+ * blocks keyed by last access time, so the distance is the number of keys
+ * newer than the block's previous access. One thread runs per block size.
+ */
+typedef struct //Treap node, one per block and set-bit level
+{
+    unsigned long int key; //time of last access
+    unsigned int priority;
+    long int size;
+    long int left; //node indices run to blocks * levels, past the range of int on long traces
+    long int right;
+} SweepNode;
+
+typedef struct //Stack distance state for one block size
+{
+    pthread_t thread;
+    int b;
+    int levels;             //set-bit levels 0..s
+    unsigned long int now;  //accesses so far
+    unsigned long int* hash_block; //block -> last access time and node
+    unsigned long int* hash_time;
+    long int* hash_node;
+    unsigned long int hash_size;
+    unsigned long int blocks;
+    SweepNode* nodes;       //levels nodes per block, block-major
+    unsigned long int node_capacity;
+    long int** roots;       //roots[level][set]
+    unsigned long int** mru; //mru[level][set], last access time in the set
+    unsigned long int** histogram; //histogram[level][d], d < E
+    unsigned int seed;
+} SweepState;
+
+static long int TreapSize(SweepNode* nodes, long int n)
+{
+    return n < 0 ? 0 : nodes[n].size;
+}
+
+static void TreapUpdate(SweepNode* nodes, long int n)
+{
+    nodes[n].size = 1 + TreapSize(nodes, nodes[n].left) + TreapSize(nodes, nodes[n].right);
+    return;
+}
+
+static long int TreapMerge(SweepNode* nodes, long int l, long int r)
+{
+    if(l < 0)
+        return r;
+    if(r < 0)
+        return l;
+    if(nodes[l].priority > nodes[r].priority)
+    {
+        nodes[l].right = TreapMerge(nodes, nodes[l].right, r);
+        TreapUpdate(nodes, l);
+        return l;
+    }
+    nodes[r].left = TreapMerge(nodes, l, nodes[r].left);
+    TreapUpdate(nodes, r);
+    return r;
+}
+
+static void TreapSplit(SweepNode* nodes, long int n, unsigned long int key, long int* l, long int* r) //l gets keys <= key
+{
+    if(n < 0)
+    {
+        *l = *r = -1;
+        return;
+    }
+    if(nodes[n].key <= key)
+    {
+        TreapSplit(nodes, nodes[n].right, key, &nodes[n].right, r);
+        *l = n;
+    }
+    else
+    {
+        TreapSplit(nodes, nodes[n].left, key, l, &nodes[n].left);
+        *r = n;
+    }
+    TreapUpdate(nodes, n);
+    return;
+}
+
+static long int TreapPopMax(SweepNode* nodes, long int n, long int* max)
+{
+    if(nodes[n].right < 0)
+    {
+        *max = n;
+        return nodes[n].left;
+    }
+    nodes[n].right = TreapPopMax(nodes, nodes[n].right, max);
+    TreapUpdate(nodes, n);
+    return n;
+}
+
+static unsigned long int SweepSlot(SweepState* state, unsigned long int block)
+{
+    unsigned long int slot = (block * 0x9e3779b97f4a7c15UL) & (state->hash_size - 1);
+
+    while(state->hash_time[slot] != 0 && state->hash_block[slot] != block)
+    {
+        slot = (slot + 1) & (state->hash_size - 1);
+    }
+    return slot;
+}
+
+static void SweepGrow(SweepState* state)
+{
+    unsigned long int old_size = state->hash_size;
+    unsigned long int* old_block = state->hash_block;
+    unsigned long int* old_time = state->hash_time;
+    long int* old_node = state->hash_node;
+
+    state->hash_size = old_size ? old_size * 2 : 1024;
+    state->hash_block = (unsigned long int*)calloc(state->hash_size, sizeof(unsigned long int));
+    state->hash_time = (unsigned long int*)calloc(state->hash_size, sizeof(unsigned long int));
+    state->hash_node = (long int*)calloc(state->hash_size, sizeof(long int));
+    for(unsigned long int i = 0; i < old_size; i++)
+    {
+        if(old_time[i] != 0)
+        {
+            unsigned long int slot = SweepSlot(state, old_block[i]);
+            state->hash_block[slot] = old_block[i];
+            state->hash_time[slot] = old_time[i];
+            state->hash_node[slot] = old_node[i];
+        }
+    }
+    free(old_block);
+    free(old_time);
+    free(old_node);
+    return;
+}
+
+static void SweepAccess(SweepState* state, unsigned long int address)
+{
+    unsigned long int block = address >> state->b;
+    unsigned long int slot;
+    unsigned long int last;
+    long int node;
+
+    if(state->blocks * 2 >= state->hash_size)
+        SweepGrow(state);
+
+    state->now++;
+    slot = SweepSlot(state, block);
+    last = state->hash_time[slot];
+
+    if(last == 0) //compulsory miss at every level
+    {
+        if((state->blocks + 1) * state->levels > state->node_capacity)
+        {
+            state->node_capacity = state->node_capacity ? state->node_capacity * 2 : 1024 * state->levels;
+            state->nodes = (SweepNode*)realloc(state->nodes, sizeof(SweepNode) * state->node_capacity);
+        }
+        node = (long int)(state->blocks++ * state->levels);
+        state->hash_block[slot] = block;
+        state->hash_node[slot] = node;
+
+        for(int level = 0; level < state->levels; level++)
+        {
+            SweepNode* n = &state->nodes[node + level];
+            long int* root = &state->roots[level][block & ((1UL << level) - 1)];
+
+            n->key = state->now;
+            n->priority = rand_r(&state->seed);
+            n->size = 1;
+            n->left = n->right = -1;
+            *root = TreapMerge(state->nodes, *root, node + level);
+            state->mru[level][block & ((1UL << level) - 1)] = state->now;
+        }
+    }
+    else
+    {
+        for(int level = 0; level < state->levels; level++)
+        {
+            unsigned long int set = block & ((1UL << level) - 1);
+            long int* root = &state->roots[level][set];
+            long int older, newer, self;
+            long int distance;
+
+            if(state->mru[level][set] == last) //still the newest key, update in place
+            {
+                state->nodes[state->hash_node[slot] + level].key = state->now;
+                state->mru[level][set] = state->now;
+                state->histogram[level][0]++;
+                continue;
+            }
+
+            TreapSplit(state->nodes, *root, last, &older, &newer);
+            distance = TreapSize(state->nodes, newer);
+            if(distance < E)
+                state->histogram[level][distance]++;
+
+            older = TreapPopMax(state->nodes, older, &self);
+            state->nodes[self].key = state->now;
+            state->nodes[self].left = state->nodes[self].right = -1;
+            state->nodes[self].size = 1;
+            *root = TreapMerge(state->nodes, TreapMerge(state->nodes, older, newer), self);
+            state->mru[level][set] = state->now;
+        }
+    }
+    state->hash_time[slot] = state->now;
+    return;
+}
+
+static void SweepLines(SweepState* state, unsigned long int address, int size)
+{
+    unsigned long int last = address;
+
+    if(split_flag && size > 1)
+        last = address + size - 1;
+    for(unsigned long int line = address >> state->b; line <= (last >> state->b); line++)
+    {
+        SweepAccess(state, line << state->b);
+    }
+    return;
+}
+
+static void SweepRecord(char operation, unsigned long int address, int size, void* arg)
+{
+    SweepState* state = (SweepState*)arg;
+
+    switch(operation)
+    {
+        case 'M':
+            SweepLines(state, address, size);
+            SweepLines(state, address, size);
+            break;
+        case 'L':
+        case 'S':
+            SweepLines(state, address, size);
+            break;
+    }
+    return;
+}
+
+static int sweep_count = 0;
+
+static void SweepAllRecord(char operation, unsigned long int address, int size, void* arg)
+{
+    SweepState* states = (SweepState*)arg;
+
+    for(int i = 0; i < sweep_count; i++)
+    {
+        SweepRecord(operation, address, size, &states[i]);
+    }
+    return;
+}
+
+static void SweepInit(SweepState* state)
+{
+    state->roots = (long int**)malloc(sizeof(long int*) * state->levels);
+    state->mru = (unsigned long int**)malloc(sizeof(unsigned long int*) * state->levels);
+    state->histogram = (unsigned long int**)malloc(sizeof(unsigned long int*) * state->levels);
+    for(int level = 0; level < state->levels; level++)
+    {
+        state->roots[level] = (long int*)malloc(sizeof(long int) * (1UL << level));
+        memset(state->roots[level], -1, sizeof(long int) * (1UL << level));
+        state->mru[level] = (unsigned long int*)calloc(1UL << level, sizeof(unsigned long int));
+        state->histogram[level] = (unsigned long int*)calloc(E, sizeof(unsigned long int));
+    }
+    return;
+}
+
+static void* SweepBlockSize(void* arg)
+{
+    SweepState* state = (SweepState*)arg;
+
+    SweepInit(state);
+    ForEachRecord(t, SweepRecord, state);
+    return NULL;
+}
+
+void Sweep()
+{
+    SweepState* states;
+    int count = 1;
+    int stream = IsStream(t);
+    char* p = w;
+
+    if(E < 1)
+        E = 1; //curves always start at direct-mapped
+
+    while((p = strchr(p, ',')) != NULL)
+    {
+        count++;
+        p++;
+    }
+
+    states = (SweepState*)calloc(count, sizeof(SweepState));
+    p = w;
+    for(int i = 0; i < count; i++)
+    {
+        states[i].b = (int)strtol(p, &p, 10);
+        states[i].levels = s + 1;
+        states[i].seed = i + 1;
+        p++;
+        if(stream) //a pipe can only be read once, so one pass feeds every block size
+            SweepInit(&states[i]);
+        else
+            pthread_create(&states[i].thread, NULL, SweepBlockSize, &states[i]);
+    }
+    if(stream)
+    {
+        sweep_count = count;
+        ForEachRecord(t, SweepAllRecord, states);
+    }
+
+    printf("b,s,E,size,hits,misses,evictions,miss_ratio\n");
+    for(int i = 0; i < count; i++)
+    {
+        SweepState* state = &states[i];
+
+        if(!stream)
+            pthread_join(state->thread, NULL);
+        for(int level = 0; level < state->levels; level++)
+        {
+            unsigned long int hits = 0;
+
+            for(unsigned int ways = 1; ways <= E; ways++)
+            {
+                unsigned long int misses, fills = 0;
+
+                hits += state->histogram[level][ways - 1];
+                misses = state->now - hits;
+                for(unsigned long int set = 0; set < (1UL << level); set++) //misses that found a free line
+                {
+                    unsigned long int resident = TreapSize(state->nodes, state->roots[level][set]);
+                    fills += resident < ways ? resident : ways;
+                }
+                printf("%d,%d,%u,%lu,%lu,%lu,%lu,%.6f\n", state->b, level, ways,
+                       (1UL << (level + state->b)) * ways, hits, misses, misses - fills,
+                       state->now ? (double)misses / state->now : 0.0);
+            }
+            free(state->roots[level]);
+            free(state->mru[level]);
+            free(state->histogram[level]);
+        }
+        free(state->roots);
+        free(state->mru);
+        free(state->histogram);
+        free(state->nodes);
+        free(state->hash_block);
+        free(state->hash_time);
+        free(state->hash_node);
+    }
+    free(states);
+    return;
+}
+
+/*
+ * Sampled mode: set sampling simulates only the sets whose hashed index
+ * falls below the -x fraction, and time sampling repeats windows of warm
+ * records (simulated but not counted, to refill the cache), measured
+ * records and skipped records (not simulated at all). Each sampled set, or
+ * each measured window when -y is given, is one sample; the rates are
+ * ratio estimates over the samples and their 95% confidence intervals come
+ * from the spread between samples. Totals are the rates scaled to every
+ * line access of the trace.
+ */
+typedef struct //Counts of one sample
+{
+    unsigned long int accesses;
+    unsigned long int count[3]; //hits, misses, evictions
+} SampleUnit;
+
+typedef struct //Sums over all samples for the ratio estimator
+{
+    double n;
+    double a, aa;
+    double x[3], xx[3], xa[3];
+} SampleSums;
+
+static unsigned char* set_sampled;
+static SampleUnit* set_samples;
+static SampleUnit window;
+static SampleSums sample_sums;
+static unsigned long int sample_warm = 0;
+static unsigned long int sample_measure = 1;
+static unsigned long int sample_period = 1;
+static unsigned long int sample_records = 0;
+static unsigned long int sample_lines = 0; //line accesses in the whole trace
+
+static void SampleAdd(SampleUnit* unit)
+{
+    double a = (double)unit->accesses;
+
+    sample_sums.n++;
+    sample_sums.a += a;
+    sample_sums.aa += a * a;
+    for(int k = 0; k < 3; k++)
+    {
+        double x = (double)unit->count[k];
+
+        sample_sums.x[k] += x;
+        sample_sums.xx[k] += x * x;
+        sample_sums.xa[k] += x * a;
+    }
+    memset(unit, 0, sizeof(SampleUnit));
+    return;
+}
+
+static void SampleLines(unsigned long int address, int lines, int phase)
+{
+    for(int i = 0; i < lines; i++)
+    {
+        unsigned long int line = ((address >> b) + i) << b;
+        unsigned long int set = (line >> b) & (S - 1);
+        SampleUnit* unit = (y != NULL) ? &window : &set_samples[set];
+        int result;
+
+        sample_lines++;
+        if(phase == 2 || !set_sampled[set])
+            continue;
+
+        result = cache_simulate(cache, line, NULL);
+        if(phase == 0)
+            continue;
+        unit->accesses++;
+        unit->count[(result == CACHE_HIT) ? 0 : 1]++;
+        if(result == CACHE_MISS_EVICTION)
+            unit->count[2]++;
+    }
+    return;
+}
+
+static void SampleRecord(char operation, unsigned long int address, int size, void* arg)
+{
+    unsigned long int offset = sample_records % sample_period;
+    int phase = (offset < sample_warm) ? 0 : (offset < sample_warm + sample_measure) ? 1 : 2; //warm, measure, skip
+    int lines = 1;
+
+    if(operation != 'L' && operation != 'S' && operation != 'M')
+        return;
+    sample_records++;
+
+    if(split_flag && size > 1)
+        lines = (int)(((address + size - 1) >> b) - (address >> b)) + 1;
+    SampleLines(address, lines, phase);
+    if(operation == 'M')
+        SampleLines(address, lines, phase);
+
+    if(y != NULL && offset == sample_warm + sample_measure - 1)
+        SampleAdd(&window); //end of a measured window
+    return;
+}
+
+void Sample()
+{
+    static const char* names[3] = {"hit_rate", "miss_rate", "eviction_rate"};
+    unsigned long int estimate[3];
+    unsigned long int sampled_sets = 0;
+    double population;
+    double fpc;
+
+    if(prefetch_kind != CACHE_PREFETCH_NONE || T != NULL || profile_file != NULL)
+    {
+        fprintf(stderr, "Sampling does not support -f, -T or -p\n");
+        exit(1);
+    }
+    if(x < 0 || x > 1)
+    {
+        fprintf(stderr, "%g: Sampling fraction must be in (0, 1]\n", x);
+        exit(1);
+    }
+    if(y != NULL)
+    {
+        unsigned long int skip = 0;
+
+        if(sscanf(y, "%lu:%lu:%lu", &sample_warm, &sample_measure, &skip) != 3 || sample_measure == 0)
+        {
+            fprintf(stderr, "%s: Expected warm:measure:skip records\n", y);
+            exit(1);
+        }
+        sample_period = sample_warm + sample_measure + skip;
+    }
+
+    //Set 0 always hashes to 0, so at least one set is sampled
+    set_sampled = (unsigned char*)malloc(S);
+    set_samples = (SampleUnit*)calloc(S, sizeof(SampleUnit));
+    for(unsigned long int set = 0; set < (unsigned long int)S; set++)
+    {
+        set_sampled[set] = (x == 0 || (double)((set * 0x9e3779b97f4a7c15UL) >> 40) < x * (1 << 24));
+        sampled_sets += set_sampled[set];
+    }
+
+    ForEachRecord(t, SampleRecord, NULL);
+
+    if(y != NULL)
+    {
+        if(window.accesses > 0)
+            SampleAdd(&window); //partial last window
+        population = (double)sample_records / sample_measure; //windows the trace could be cut into
+    }
+    else
+    {
+        for(int set = 0; set < S; set++)
+        {
+            if(set_sampled[set])
+                SampleAdd(&set_samples[set]);
+        }
+        population = S;
+    }
+    fpc = (population > sample_sums.n) ? 1 - sample_sums.n / population : 0;
+
+    printf("sampled:%.0f of %lu line accesses in %.0f %s\n", sample_sums.a, sample_lines, sample_sums.n,
+           (y != NULL) ? "windows" : "sets");
+    for(int k = 0; k < 3; k++)
+    {
+        double n = sample_sums.n;
+        double rate = (sample_sums.a > 0) ? sample_sums.x[k] / sample_sums.a : 0;
+        double mean_a = sample_sums.a / n;
+
+        estimate[k] = (unsigned long int)(rate * sample_lines + 0.5);
+        printf("%s:%.4f", names[k], rate);
+        if(n >= 2 && mean_a > 0)
+        {
+            double spread = sample_sums.xx[k] - 2 * rate * sample_sums.xa[k] + rate * rate * sample_sums.aa;
+            double variance = spread / (n * (n - 1) * mean_a * mean_a) * fpc;
+
+            printf(" +-%.4f", 1.96 * sqrt(variance > 0 ? variance : 0));
+        }
+        else
+        {
+            printf(" +-n/a");
+        }
+        printf((k < 2) ? " " : " (95%% confidence)\n");
+    }
+    printSummary(estimate[0], estimate[1], estimate[2]);
+
+    free(set_sampled);
+    free(set_samples);
+    return;
+}
+
+/*
+ * SplitLines - Return the number of lines an access touches, recording its
+ *     address as a split hotspot when it crosses a line boundary.
+ */
+int SplitLines(unsigned long int address, int size)
+{
+    int lines;
+
+    if(size <= 1)
+        return 1;
+
+    lines = (int)(((address + size - 1) >> b) - (address >> b)) + 1;
+    if(lines > 1)
+        cache_count_add(&split_table, address, 1);
+    return lines;
+}
+
+void PrintSplitSummary()
+{
+    unsigned long int keys[TOP_N], counts[TOP_N];
+    int found = cache_count_top(&split_table, TOP_N, keys, counts);
+
+    printf("splits:%lu extra_lines:%lu split_misses:%lu\n", stats.split_count, stats.split_line_count, stats.split_miss_count);
+    for(int i = 0; i < found; i++)
+    {
+        printf("  split %lx: %lu\n", keys[i], counts[i]);
+    }
+    cache_count_free(&split_table);
+    return;
+}
+
+/*
+ * Profiling mode: every miss is classified with the 3C model. A block never
+ * seen before is a compulsory miss; otherwise a shadow fully-associative
+ * LRU cache with the same number of lines decides between capacity (it
+ * misses too) and conflict (it would have hit). Counts are kept per set and
+ * per missing line/address for the hotspot report.
+ */
+typedef struct //Shadow fully-associative LRU cache
+{
+    unsigned long int* block;
+    int* prev;     //recency list, head is most recent
+    int* next;
+    int* chain;    //next node in the same hash bucket
+    int* bucket;
+    int bucket_mask;
+    int head;
+    int tail;
+    int used;
+    int capacity;
+} ShadowCache;
+
+typedef struct //Per-set heatmap entry
+{
+    unsigned long int accesses;
+    unsigned long int misses;
+    unsigned long int compulsory;
+    unsigned long int capacity;
+    unsigned long int conflict;
+} SetProfile;
+
+static ShadowCache shadow;
+static SetProfile* set_profile;
+static cache_count_t seen_blocks;
+static cache_count_t miss_lines;
+static cache_count_t miss_addresses;
+
+void ProfileInit()
+{
+    int buckets = 1;
+
+    shadow.capacity = S * E;
+    while(buckets < shadow.capacity * 2)
+    {
+        buckets <<= 1;
+    }
+    shadow.block = (unsigned long int*)malloc(sizeof(unsigned long int) * shadow.capacity);
+    shadow.prev = (int*)malloc(sizeof(int) * shadow.capacity);
+    shadow.next = (int*)malloc(sizeof(int) * shadow.capacity);
+    shadow.chain = (int*)malloc(sizeof(int) * shadow.capacity);
+    shadow.bucket = (int*)malloc(sizeof(int) * buckets);
+    memset(shadow.bucket, -1, sizeof(int) * buckets);
+    shadow.bucket_mask = buckets - 1;
+    shadow.head = shadow.tail = -1;
+    shadow.used = 0;
+
+    set_profile = (SetProfile*)calloc(S, sizeof(SetProfile));
+    return;
+}
+
+static void ShadowUnlink(int n)
+{
+    if(shadow.prev[n] >= 0)
+        shadow.next[shadow.prev[n]] = shadow.next[n];
+    else
+        shadow.head = shadow.next[n];
+    if(shadow.next[n] >= 0)
+        shadow.prev[shadow.next[n]] = shadow.prev[n];
+    else
+        shadow.tail = shadow.prev[n];
+    return;
+}
+
+static void ShadowPushFront(int n)
+{
+    shadow.prev[n] = -1;
+    shadow.next[n] = shadow.head;
+    if(shadow.head >= 0)
+        shadow.prev[shadow.head] = n;
+    shadow.head = n;
+    if(shadow.tail < 0)
+        shadow.tail = n;
+    return;
+}
+
+/*
+ * ShadowAccess - Touch block in the shadow cache and return 1 if it was
+ *     resident.
+ */
+static int ShadowAccess(unsigned long int block)
+{
+    int* link = &shadow.bucket[(block * 0x9e3779b97f4a7c15UL >> 32) & shadow.bucket_mask];
+    int n;
+
+    for(n = *link; n >= 0; n = shadow.chain[n])
+    {
+        if(shadow.block[n] == block)
+        {
+            ShadowUnlink(n);
+            ShadowPushFront(n);
+            return 1;
+        }
+    }
+
+    if(shadow.used < shadow.capacity)
+    {
+        n = shadow.used++;
+    }
+    else //reuse the least recently used node
+    {
+        int* victim;
+
+        n = shadow.tail;
+        ShadowUnlink(n);
+        victim = &shadow.bucket[(shadow.block[n] * 0x9e3779b97f4a7c15UL >> 32) & shadow.bucket_mask];
+        while(*victim != n)
+        {
+            victim = &shadow.chain[*victim];
+        }
+        *victim = shadow.chain[n];
+    }
+    shadow.block[n] = block;
+    shadow.chain[n] = *link;
+    *link = n;
+    ShadowPushFront(n);
+    return 0;
+}
+
+void ProfileAccess(unsigned long int address, int result)
+{
+    unsigned long int block = address >> b;
+    SetProfile* set = &set_profile[block & (S - 1)];
+    int shadow_hit = ShadowAccess(block);
+
+    set->accesses++;
+    if(result == CACHE_HIT)
+        return;
+
+    set->misses++;
+    if(cache_count_get(&seen_blocks, block) == 0)
+    {
+        set->compulsory++;
+        cache_count_add(&seen_blocks, block, 1);
+    }
+    else if(shadow_hit)
+        set->conflict++;
+    else
+        set->capacity++;
+
+    cache_count_add(&miss_lines, block << b, 1);
+    cache_count_add(&miss_addresses, address, 1);
+    return;
+}
+
+static void WriteTop(FILE* out, int csv, const char* kind, cache_count_t* table)
+{
+    unsigned long int* keys = (unsigned long int*)malloc(sizeof(unsigned long int) * top_n);
+    unsigned long int* counts = (unsigned long int*)malloc(sizeof(unsigned long int) * top_n);
+    int found = cache_count_top(table, top_n, keys, counts);
+
+    for(int i = 0; i < found; i++)
+    {
+        if(csv)
+            fprintf(out, "%s,0x%lx,,%lu,,,\n", kind, keys[i], counts[i]);
+        else
+            fprintf(out, "%s[\"0x%lx\",%lu]", i ? "," : "", keys[i], counts[i]);
+    }
+    free(keys);
+    free(counts);
+    return;
+}
+
+void WriteProfile()
+{
+    FILE* out;
+    const char* ext = strrchr(profile_file, '.');
+    int csv = (ext != NULL && strcmp(ext, ".csv") == 0);
+    SetProfile total = {0, 0, 0, 0, 0};
+
+    if((out = fopen(profile_file, "w")) == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open profile file\n", profile_file);
+        exit(1);
+    }
+
+    for(int i = 0; i < S; i++)
+    {
+        total.accesses += set_profile[i].accesses;
+        total.misses += set_profile[i].misses;
+        total.compulsory += set_profile[i].compulsory;
+        total.capacity += set_profile[i].capacity;
+        total.conflict += set_profile[i].conflict;
+    }
+
+    if(csv)
+    {
+        fprintf(out, "kind,key,accesses,misses,compulsory,capacity,conflict\n");
+        fprintf(out, "total,,%lu,%lu,%lu,%lu,%lu\n", total.accesses, total.misses, total.compulsory, total.capacity, total.conflict);
+        for(int i = 0; i < S; i++)
+        {
+            SetProfile* set = &set_profile[i];
+            fprintf(out, "set,%d,%lu,%lu,%lu,%lu,%lu\n", i, set->accesses, set->misses, set->compulsory, set->capacity, set->conflict);
+        }
+        WriteTop(out, csv, "line", &miss_lines);
+        WriteTop(out, csv, "address", &miss_addresses);
+    }
+    else
+    {
+        fprintf(out, "{\"s\":%d,\"E\":%u,\"b\":%d,", s, E, b);
+        fprintf(out, "\"total\":{\"accesses\":%lu,\"misses\":%lu,\"compulsory\":%lu,\"capacity\":%lu,\"conflict\":%lu},\n",
+                total.accesses, total.misses, total.compulsory, total.capacity, total.conflict);
+        fprintf(out, "\"sets\":[");
+        for(int i = 0; i < S; i++)
+        {
+            SetProfile* set = &set_profile[i];
+            fprintf(out, "%s[%lu,%lu,%lu,%lu,%lu]", i ? "," : "", set->accesses, set->misses, set->compulsory, set->capacity, set->conflict);
+        }
+        fprintf(out, "],\n\"top_lines\":[");
+        WriteTop(out, csv, "line", &miss_lines);
+        fprintf(out, "],\n\"top_addresses\":[");
+        WriteTop(out, csv, "address", &miss_addresses);
+        fprintf(out, "]}\n");
+    }
+    fclose(out);
+
+    free(shadow.block);
+    free(shadow.prev);
+    free(shadow.next);
+    free(shadow.chain);
+    free(shadow.bucket);
+    free(set_profile);
+    cache_count_free(&seen_blocks);
+    cache_count_free(&miss_lines);
+    cache_count_free(&miss_addresses);
+    return;
+}
+
+/*
+ * Prefetchers: the models themselves live in the cache (cachesim.c); -f
+ * only selects one and its degree.
+ */
+void PrefetchInit(char* spec)
+{
+    char* degree = strchr(spec, ':');
+
+    if(degree != NULL)
+        *degree++ = '\0';
+
+    if(strcmp(spec, "next") == 0)
+    {
+        prefetch_kind = CACHE_PREFETCH_NEXT;
+    }
+    else if(strcmp(spec, "stride") == 0)
+    {
+        prefetch_kind = CACHE_PREFETCH_STRIDE;
+    }
+    else if(strcmp(spec, "stream") == 0)
+    {
+        prefetch_kind = CACHE_PREFETCH_STREAM;
+    }
+    else
+    {
+        fprintf(stderr, "%s: Unknown prefetcher\n", spec);
+        exit(1);
+    }
+
+    if(degree != NULL && atoi(degree) > 0)
+        prefetch_degree = atoi(degree); //0 keeps the cache's default
+    return;
+}
+
+void PrintPrefetchSummary()
+{
+    unsigned long int issued = stats.prefetch_issued;
+    unsigned long int useful = stats.prefetch_useful;
+
+    printf("prefetch issued:%lu useful:%lu useless:%lu pollution:%lu accuracy:%.3f coverage:%.3f\n",
+           issued, useful, stats.prefetch_useless, stats.prefetch_pollution,
+           issued ? (double)useful / issued : 0.0,
+           (useful + stats.miss_count) ? (double)useful / (useful + stats.miss_count) : 0.0);
+    return;
+}
+
+/*
+ * TLB model: for every page size listed with -T, each access is translated
+ * through an L1 DTLB and a second-level STLB sized like a recent x86 core.
+ * An STLB miss walks the four-level radix page table; 2M and 1G pages stop
+ * one and two levels early. Paging-structure caches for the PML4, PDPT and
+ * PD entries let a walk skip the levels they cover, so a walk costs
+ * between 1 and 4 page-table references. Running the page sizes side by
+ * side shows directly how much huge pages would save.
+ */
+typedef struct //Small set-associative LRU translation cache
+{
+    int sets;
+    int ways;
+    unsigned long int* tags;   //key + 1, 0 is empty
+    unsigned long int* stamps; //last use
+    unsigned long int clock;
+} TlbLevel;
+
+typedef struct //TLB hierarchy for one page size
+{
+    const char* name;
+    int page_bits;
+    int walk_levels;  //page-table levels down to the leaf entry
+    TlbLevel dtlb;
+    TlbLevel stlb;
+    TlbLevel pwc[PAGE_LEVELS - 1]; //PML4E, PDPTE and PDE caches
+    unsigned long int accesses;
+    unsigned long int dtlb_misses;
+    unsigned long int stlb_misses;
+    unsigned long int walk_refs;
+    unsigned long int pwc_hits;
+} Tlb;
+
+static Tlb tlbs[MAX_PAGE_SIZES];
+static int tlb_count = 0;
+
+static void TlbLevelInit(TlbLevel* level, int entries, int ways)
+{
+    level->ways = ways;
+    level->sets = entries / ways;
+    level->tags = (unsigned long int*)calloc(entries, sizeof(unsigned long int));
+    level->stamps = (unsigned long int*)calloc(entries, sizeof(unsigned long int));
+    level->clock = 0;
+    return;
+}
+
+/*
+ * TlbLookup - Look key up, filling it over the LRU way on a miss, and
+ *     return 1 on a hit.
+ */
+static int TlbLookup(TlbLevel* level, unsigned long int key)
+{
+    int base = (int)(key % level->sets) * level->ways;
+    int victim = base;
+
+    level->clock++;
+    for(int i = base; i < base + level->ways; i++)
+    {
+        if(level->tags[i] == key + 1)
+        {
+            level->stamps[i] = level->clock;
+            return 1;
+        }
+        if(level->stamps[i] < level->stamps[victim])
+            victim = i;
+    }
+    level->tags[victim] = key + 1;
+    level->stamps[victim] = level->clock;
+    return 0;
+}
+
+void TlbInit(char* spec)
+{
+    char* name = strtok(spec, ",");
+
+    while(name != NULL && tlb_count < MAX_PAGE_SIZES)
+    {
+        Tlb* tlb = &tlbs[tlb_count];
+
+        if(strcmp(name, "4k") == 0 || strcmp(name, "4K") == 0)
+        {
+            tlb->page_bits = 12;
+            TlbLevelInit(&tlb->dtlb, 64, 4);
+            TlbLevelInit(&tlb->stlb, 1536, 12);
+        }
+        else if(strcmp(name, "2m") == 0 || strcmp(name, "2M") == 0)
+        {
+            tlb->page_bits = 21;
+            TlbLevelInit(&tlb->dtlb, 32, 4);
+            TlbLevelInit(&tlb->stlb, 1536, 12);
+        }
+        else if(strcmp(name, "1g") == 0 || strcmp(name, "1G") == 0)
+        {
+            tlb->page_bits = 30;
+            TlbLevelInit(&tlb->dtlb, 4, 4);
+            TlbLevelInit(&tlb->stlb, 16, 4);
+        }
+        else
+        {
+            fprintf(stderr, "%s: Unknown page size\n", name);
+            exit(1);
+        }
+        tlb->name = name;
+        tlb->walk_levels = PAGE_LEVELS - (tlb->page_bits - 12) / 9;
+        TlbLevelInit(&tlb->pwc[0], 2, 2);   //PML4E cache
+        TlbLevelInit(&tlb->pwc[1], 4, 4);   //PDPTE cache
+        TlbLevelInit(&tlb->pwc[2], 32, 32); //PDE cache
+        tlb_count++;
+        name = strtok(NULL, ",");
+    }
+    return;
+}
+
+void TlbAccess(unsigned long int address)
+{
+    for(int i = 0; i < tlb_count; i++)
+    {
+        Tlb* tlb = &tlbs[i];
+        unsigned long int page = address >> tlb->page_bits;
+        int skipped = 0;
+
+        tlb->accesses++;
+        if(TlbLookup(&tlb->dtlb, page))
+            continue;
+        tlb->dtlb_misses++;
+        if(TlbLookup(&tlb->stlb, page))
+            continue;
+        tlb->stlb_misses++;
+
+        //Walk: the deepest cached non-leaf entry lets the walk skip every level above it
+        for(int level = tlb->walk_levels - 2; level >= 0; level--)
+        {
+            unsigned long int prefix = address >> (39 - 9 * level);
+
+            if(TlbLookup(&tlb->pwc[level], prefix))
+            {
+                if(!skipped)
+                {
+                    skipped = level + 1;
+                    tlb->pwc_hits++;
+                }
+            }
+        }
+        tlb->walk_refs += tlb->walk_levels - skipped;
+    }
+    return;
+}
+
+void PrintTlbSummary()
+{
+    for(int i = 0; i < tlb_count; i++)
+    {
+        Tlb* tlb = &tlbs[i];
+
+        printf("tlb %s: accesses:%lu dtlb_misses:%lu stlb_misses:%lu walk_refs:%lu pwc_hits:%lu\n",
+               tlb->name, tlb->accesses, tlb->dtlb_misses, tlb->stlb_misses, tlb->walk_refs, tlb->pwc_hits);
+
+        free(tlb->dtlb.tags);
+        free(tlb->dtlb.stamps);
+        free(tlb->stlb.tags);
+        free(tlb->stlb.stamps);
+        for(int level = 0; level < PAGE_LEVELS - 1; level++)
+        {
+            free(tlb->pwc[level].tags);
+            free(tlb->pwc[level].stamps);
+        }
+    }
+    return;
+}
+
+/*
+ * Multi-core mode: every trace drives its own private cache of the same
+ * geometry and the caches are kept coherent with MESI by snooping the
+ * other cores on every miss or write. A write that invalidates a copy the
+ * other core never read or wrote a byte of is counted as false sharing,
+ * and a later miss of that core on the line as a coherence miss.
+ */
+typedef struct //Coherence state of one line of a core's cache
+{
+    int state; //MESI_*
+    unsigned long int touched; //bytes used since the fill
+} CoreLine;
+
+typedef struct //One core: private cache, trace and counters
+{
+    cache_t* cache;
+    CoreLine* lines; //S * E, numbered as by cache_simulate
+    TraceStream* stream;
+    char operation;  //next record
+    unsigned long int address;
+    int size;
+    unsigned long int timestamp;
+    int live;
+    int hit_count;
+    int miss_count;
+    int eviction_count;
+    int coherence_miss_count;
+    int invalidation_count;
+    int writeback_count;
+    int upgrade_count;
+    cache_count_t lost; //odd count: invalidated by another core, not missed on since
+} Core;
+
+static Core* cores;
+static cache_count_t false_shared; //false sharing invalidations by line
+static int false_sharing_count = 0;
+static int true_sharing_count = 0;
+
+static unsigned long int ByteMask(unsigned long int address, int size)
+{
+    int offset = (int)(address & (B - 1));
+
+    if(B > 64 || size >= 64)
+        return ~0UL;
+    if(size < 1)
+        size = 1;
+    return (size == 64 ? ~0UL : ((1UL << size) - 1)) << (offset & 63);
+}
+
+static void CoreAccess(int id, unsigned long int address, int size, int write)
+{
+    Core* core = &cores[id];
+    unsigned long int block = address >> b;
+    unsigned long int mask = ByteMask(address, size);
+    long int slot;
+    int result = cache_simulate(core->cache, address, &slot);
+    CoreLine* line = &core->lines[slot];
+
+    if(result == CACHE_HIT)
+    {
+        core->hit_count++;
+    }
+    else
+    {
+        core->miss_count++;
+        if(result == CACHE_MISS_EVICTION)
+            core->eviction_count++;
+        if(result == CACHE_MISS_EVICTION && line->state == MESI_MODIFIED) //the victim still holds the slot's state
+            core->writeback_count++;
+        if(cache_count_get(&core->lost, block) % 2 == 1)
+        {
+            core->coherence_miss_count++;
+            cache_count_add(&core->lost, block, 1);
+        }
+        line->state = MESI_INVALID;
+        line->touched = 0;
+    }
+
+    if(!write && result != CACHE_HIT) //BusRd: other copies drop to shared
+    {
+        int shared = 0;
+
+        for(int i = 0; i < core_count; i++)
+        {
+            long int found = (i == id) ? -1 : cache_find(cores[i].cache, address);
+            CoreLine* other;
+
+            if(found < 0)
+                continue;
+            other = &cores[i].lines[found];
+            if(other->state == MESI_MODIFIED)
+                cores[i].writeback_count++;
+            other->state = MESI_SHARED;
+            shared = 1;
+        }
+        line->state = shared ? MESI_SHARED : MESI_EXCLUSIVE;
+    }
+    else if(write && line->state != MESI_MODIFIED) //BusRdX or upgrade: invalidate other copies
+    {
+        if(line->state == MESI_SHARED)
+            core->upgrade_count++;
+        for(int i = 0; i < core_count; i++)
+        {
+            long int found = (i == id) ? -1 : cache_find(cores[i].cache, address);
+            CoreLine* other;
+
+            if(found < 0)
+                continue;
+            other = &cores[i].lines[found];
+            if(other->state == MESI_MODIFIED)
+                cores[i].writeback_count++;
+            if(other->touched & mask)
+            {
+                true_sharing_count++;
+            }
+            else
+            {
+                false_sharing_count++;
+                cache_count_add(&false_shared, block << b, 1);
+            }
+            cache_invalidate(cores[i].cache, found);
+            other->state = MESI_INVALID;
+            cores[i].invalidation_count++;
+            if(cache_count_get(&cores[i].lost, block) % 2 == 0)
+                cache_count_add(&cores[i].lost, block, 1);
+        }
+        line->state = MESI_MODIFIED;
+    }
+    line->touched |= mask;
+    return;
+}
+
+static void CoreRecord(int id)
+{
+    Core* core = &cores[id];
+    unsigned long int first = core->address >> b;
+    unsigned long int last = first;
+
+    if(split_flag && core->size > 1)
+        last = (core->address + core->size - 1) >> b;
+
+    for(unsigned long int block = first; block <= last; block++)
+    {
+        unsigned long int start = (block == first) ? core->address : (block << b);
+        unsigned long int end = (block == last) ? core->address + core->size : ((block + 1) << b);
+        int size = (int)(end - start);
+
+        switch(core->operation)
+        {
+            case 'L':
+                CoreAccess(id, start, size, 0);
+                break;
+            case 'M':
+                CoreAccess(id, start, size, 0);
+                CoreAccess(id, start, size, 1);
+                break;
+            case 'S':
+                CoreAccess(id, start, size, 1);
+                break;
+        }
+    }
+    core->live = StreamNext(core->stream, &core->operation, &core->address, &core->size, &core->timestamp);
+    return;
+}
+
+void MultiCore()
+{
+    int by_timestamp = (strcmp(m, "ts") == 0);
+    int live = core_count;
+    int turn = 0;
+    int hits = 0, misses = 0, evictions = 0;
+    unsigned long int keys[TOP_N], counts[TOP_N];
+    int found;
+
+    if(strcmp(m, "rr") != 0 && strcmp(m, "ts") != 0)
+    {
+        fprintf(stderr, "%s: Expected rr or ts\n", m);
+        help_flag = 1;
+        print_helpflag();
+        exit(1);
+    }
+    if(prefetch_kind != CACHE_PREFETCH_NONE || T != NULL || profile_file != NULL)
+    {
+        fprintf(stderr, "Multi-core mode does not support -f, -T or -p\n");
+        exit(1);
+    }
+    verbose_flag = 0; //accesses of different cores are interleaved
+    cores = (Core*)calloc(core_count, sizeof(Core));
+    for(int i = 0; i < core_count; i++)
+    {
+        int fd = (strcmp(core_traces[i], "-") == 0) ? STDIN_FILENO : open(core_traces[i], O_RDONLY);
+
+        if(fd < 0)
+        {
+            fprintf(stderr, "%s: No such file\n", core_traces[i]);
+            exit(1);
+        }
+        CacheInit();
+        cores[i].cache = cache;
+        cores[i].lines = (CoreLine*)calloc((size_t)S * E, sizeof(CoreLine));
+        cores[i].stream = StreamOpen(fd);
+        cores[i].live = StreamNext(cores[i].stream, &cores[i].operation, &cores[i].address, &cores[i].size, &cores[i].timestamp);
+    }
+
+    while(live > 0)
+    {
+        int next = -1;
+
+        if(by_timestamp)
+        {
+            for(int i = 0; i < core_count; i++)
+            {
+                if(cores[i].live && (next < 0 || cores[i].timestamp < cores[next].timestamp))
+                    next = i;
+            }
+        }
+        else
+        {
+            while(!cores[turn].live)
+            {
+                turn = (turn + 1) % core_count;
+            }
+            next = turn;
+            turn = (turn + 1) % core_count;
+        }
+
+        CoreRecord(next);
+        if(!cores[next].live)
+            live--;
+    }
+
+    for(int i = 0; i < core_count; i++)
+    {
+        Core* core = &cores[i];
+
+        printf("core %d: hits:%d misses:%d evictions:%d coherence_misses:%d invalidations:%d writebacks:%d upgrades:%d\n",
+               i, core->hit_count, core->miss_count, core->eviction_count, core->coherence_miss_count,
+               core->invalidation_count, core->writeback_count, core->upgrade_count);
+        hits += core->hit_count;
+        misses += core->miss_count;
+        evictions += core->eviction_count;
+
+        if(core->stream->fd != STDIN_FILENO)
+            close(core->stream->fd);
+        StreamClose(core->stream);
+        cache = core->cache;
+        DeleteCache();
+        cache_count_free(&core->lost);
+        free(core->lines);
+    }
+    printSummary(hits, misses, evictions);
+
+    printf("false_sharing:%d true_sharing:%d\n", false_sharing_count, true_sharing_count);
+    found = cache_count_top(&false_shared, TOP_N, keys, counts);
+    for(int i = 0; i < found; i++)
+    {
+        printf("  false shared %lx: %lu\n", keys[i], counts[i]);
+    }
+    cache_count_free(&false_shared);
+    free(cores);
+    return;
+}
@@ -10,9 +10,47 @@
  * on a 1KB direct mapped cache with a block size of 32 bytes.
  */ 
 #include <stdio.h>
+#include <complex.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "cachelab.h"
 
+/* Cache the tuned kernel table is looked up for: the graded 1KB direct-mapped one */
+#ifndef TRANS_S
+#define TRANS_S 5
+#endif
+#ifndef TRANS_E
+#define TRANS_E 1
+#endif
+#ifndef TRANS_B
+#define TRANS_B 5
+#endif
+
+/* A/B accesses of the shared kernels; tune.c redefines them to trace */
+#ifndef TRANS_READ
+#define TRANS_READ(x) (x)
+#define TRANS_WRITE(x) (x)
+#endif
+
+typedef struct //Blocking of one tuned shape and cache
+{
+    int M, N;
+    int s, E, b; //cache geometry
+    int bi, bj; //tile rows and columns of A
+    int sub; //move 8x8 tiles as 4x4 sub-blocks
+    int order; //0: tiles row by row, 1: column by column
+} trans_params;
+
+#include "trans_table.h"
+
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+static void trans_recursive(int M, int N, int A[N][M], int B[M][N], int i0, int i1, int j0, int j1);
+static void trans_blocked(int M, int N, int A[N][M], int B[M][N], const trans_params* p);
+static const trans_params* trans_lookup(int M, int N);
 
 /* 
  * transpose_submit - This is the solution transpose function that you
@@ -20,13 +58,24 @@ int is_transpose(int M, int N, int A[N][M], int B[M][N]);
  *     the description string "Transpose submission", as the driver
  *     searches for that string to identify the transpose function to
  *     be graded. 
+ *
+ *     Shapes in trans_table.h for the TRANS_S/E/B cache use the tuned
+ *     blocking. The hand-tuned 32x32, 64x64 and 61x67 kernels below are
+ *     the fallback for a cache the table has no entry for, such as a
+ *     table generated without -g 5:1:5; with the shipped table and the
+ *     graded cache they are not reached.
  */
 char transpose_submit_desc[] = "Transpose submission";
 void transpose_submit(int M, int N, int A[N][M], int B[M][N])
 {
     int temp1, temp2, temp3, temp4, temp5, temp6, temp7, temp8, temp9, temp10, temp11, temp12;
+    const trans_params* params = trans_lookup(M, N);
 
-    if(M == 32 && N == 32)
+    if(params != NULL)
+    {
+        trans_blocked(M, N, A, B, params);
+    }
+    else if(M == 32 && N == 32)
     {
         for(int i = 0; i < N; i += 8)
         {
@@ -151,14 +200,814 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
             }
         }
     }
+    else
+    {
+        trans_recursive(M, N, A, B, 0, N, 0, M);
+    }
 
     return;
 }
 
-/* 
- * You can define additional transpose functions below. We've defined
- * a simple one below to help you get started. 
- */ 
+/*
+ * trans_tile - Transpose the full 8x8 tile at A[i0][j0] through registers
+ *     as four 4x4 sub-blocks like the 64x64 path, so rows of B that map to
+ *     the same sets never evict each other inside the tile.
+ */
+static void trans_tile(int M, int N, int A[N][M], int B[M][N], int i0, int j0)
+{
+    int temp1, temp2, temp3, temp4, temp5, temp6, temp7, temp8, temp9, temp10, temp11, temp12;
+
+    for(int k = i0; k < i0 + 4; k++)
+    {
+        temp1 = TRANS_READ(A[k][j0]);
+        temp2 = TRANS_READ(A[k][j0 + 1]);
+        temp3 = TRANS_READ(A[k][j0 + 2]);
+        temp4 = TRANS_READ(A[k][j0 + 3]);
+        temp5 = TRANS_READ(A[k][j0 + 4]);
+        temp6 = TRANS_READ(A[k][j0 + 5]);
+        temp7 = TRANS_READ(A[k][j0 + 6]);
+        temp8 = TRANS_READ(A[k][j0 + 7]);
+
+        TRANS_WRITE(B[j0][k]) = temp1;
+        TRANS_WRITE(B[j0 + 1][k]) = temp2;
+        TRANS_WRITE(B[j0 + 2][k]) = temp3;
+        TRANS_WRITE(B[j0 + 3][k]) = temp4;
+        TRANS_WRITE(B[j0][k + 4]) = temp5;
+        TRANS_WRITE(B[j0 + 1][k + 4]) = temp6;
+        TRANS_WRITE(B[j0 + 2][k + 4]) = temp7;
+        TRANS_WRITE(B[j0 + 3][k + 4]) = temp8;
+    }
+
+    for(int l = 0; l < 4; l++)
+    {
+        temp1 = TRANS_READ(A[i0 + 4][j0 + l]);
+        temp2 = TRANS_READ(A[i0 + 5][j0 + l]);
+        temp3 = TRANS_READ(A[i0 + 6][j0 + l]);
+        temp4 = TRANS_READ(A[i0 + 7][j0 + l]);
+        temp5 = TRANS_READ(A[i0 + 4][j0 + 4 + l]);
+        temp6 = TRANS_READ(A[i0 + 5][j0 + 4 + l]);
+        temp7 = TRANS_READ(A[i0 + 6][j0 + 4 + l]);
+        temp8 = TRANS_READ(A[i0 + 7][j0 + 4 + l]);
+
+        temp9 = TRANS_READ(B[j0 + l][i0 + 4]);
+        temp10 = TRANS_READ(B[j0 + l][i0 + 5]);
+        temp11 = TRANS_READ(B[j0 + l][i0 + 6]);
+        temp12 = TRANS_READ(B[j0 + l][i0 + 7]);
+
+        TRANS_WRITE(B[j0 + l][i0 + 4]) = temp1;
+        TRANS_WRITE(B[j0 + l][i0 + 5]) = temp2;
+        TRANS_WRITE(B[j0 + l][i0 + 6]) = temp3;
+        TRANS_WRITE(B[j0 + l][i0 + 7]) = temp4;
+
+        TRANS_WRITE(B[j0 + 4 + l][i0]) = temp9;
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 1]) = temp10;
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 2]) = temp11;
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 3]) = temp12;
+
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 4]) = temp5;
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 5]) = temp6;
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 6]) = temp7;
+        TRANS_WRITE(B[j0 + 4 + l][i0 + 7]) = temp8;
+    }
+    return;
+}
+
+/*
+ * trans_rows - Transpose the block A[i0..i1)[j0..j1) one row of A at a
+ *     time, reading up to 8 elements into registers before writing them.
+ */
+static void trans_rows(int M, int N, int A[N][M], int B[M][N], int i0, int i1, int j0, int j1)
+{
+    int temp1 = 0, temp2 = 0, temp3 = 0, temp4 = 0, temp5 = 0, temp6 = 0, temp7 = 0, temp8 = 0;
+
+    for(int k = i0; k < i1; k++)
+    {
+        for(int j = j0; j < j1; j += 8)
+        {
+            int n = j1 - j;
+
+            temp1 = TRANS_READ(A[k][j]);
+            if(n > 1) temp2 = TRANS_READ(A[k][j + 1]);
+            if(n > 2) temp3 = TRANS_READ(A[k][j + 2]);
+            if(n > 3) temp4 = TRANS_READ(A[k][j + 3]);
+            if(n > 4) temp5 = TRANS_READ(A[k][j + 4]);
+            if(n > 5) temp6 = TRANS_READ(A[k][j + 5]);
+            if(n > 6) temp7 = TRANS_READ(A[k][j + 6]);
+            if(n > 7) temp8 = TRANS_READ(A[k][j + 7]);
+
+            TRANS_WRITE(B[j][k]) = temp1;
+            if(n > 1) TRANS_WRITE(B[j + 1][k]) = temp2;
+            if(n > 2) TRANS_WRITE(B[j + 2][k]) = temp3;
+            if(n > 3) TRANS_WRITE(B[j + 3][k]) = temp4;
+            if(n > 4) TRANS_WRITE(B[j + 4][k]) = temp5;
+            if(n > 5) TRANS_WRITE(B[j + 5][k]) = temp6;
+            if(n > 6) TRANS_WRITE(B[j + 6][k]) = temp7;
+            if(n > 7) TRANS_WRITE(B[j + 7][k]) = temp8;
+        }
+    }
+    return;
+}
+
+/*
+ * trans_recursive - Cache-oblivious transpose of A[i0..i1)[j0..j1): halve
+ *     the longer side until the block is a single tile. Splits fall on
+ *     multiples of 8 elements within the matrix, so tiles stay 8x8 except
+ *     at the ragged edges; they line up with cache lines only when a row
+ *     does.
+ */
+static void trans_recursive(int M, int N, int A[N][M], int B[M][N], int i0, int i1, int j0, int j1)
+{
+    int rows = i1 - i0;
+    int cols = j1 - j0;
+
+    if(rows <= 8 && cols <= 8)
+    {
+        if(rows == 8 && cols == 8)
+            trans_tile(M, N, A, B, i0, j0);
+        else if(rows > 0 && cols > 0)
+            trans_rows(M, N, A, B, i0, i1, j0, j1);
+        return;
+    }
+
+    if(rows >= cols)
+    {
+        int half = ((rows / 2) + 7) & ~7;
+
+        trans_recursive(M, N, A, B, i0, i0 + half, j0, j1);
+        trans_recursive(M, N, A, B, i0 + half, i1, j0, j1);
+    }
+    else
+    {
+        int half = ((cols / 2) + 7) & ~7;
+
+        trans_recursive(M, N, A, B, i0, i1, j0, j0 + half);
+        trans_recursive(M, N, A, B, i0, i1, j0 + half, j1);
+    }
+    return;
+}
+
+/*
+ * trans_blocked - Transpose in bi x bj tiles of A, visited row of tiles by
+ *     row of tiles (order 0) or column by column (order 1). With sub set,
+ *     full 8x8 tiles go through trans_tile; everything else through
+ *     trans_rows. The parameters come from trans_table.h, see tune.c.
+ */
+static void trans_blocked(int M, int N, int A[N][M], int B[M][N], const trans_params* p)
+{
+    int outer = p->order ? M : N;
+    int inner = p->order ? N : M;
+    int outer_step = p->order ? p->bj : p->bi;
+    int inner_step = p->order ? p->bi : p->bj;
+
+    for(int u = 0; u < outer; u += outer_step)
+    {
+        for(int v = 0; v < inner; v += inner_step)
+        {
+            int i = p->order ? v : u;
+            int j = p->order ? u : v;
+            int i1 = (i + p->bi < N) ? i + p->bi : N;
+            int j1 = (j + p->bj < M) ? j + p->bj : M;
+
+            if(p->sub && i1 - i == 8 && j1 - j == 8)
+                trans_tile(M, N, A, B, i, j);
+            else
+                trans_rows(M, N, A, B, i, i1, j, j1);
+        }
+    }
+    return;
+}
+
+/*
+ * trans_lookup - Return the tuned parameters for an M x N transpose on the
+ *     TRANS_S/TRANS_E/TRANS_B cache, or NULL if the shape was not tuned.
+ */
+static const trans_params* trans_lookup(int M, int N)
+{
+    for(int k = 0; k < (int)(sizeof(trans_table) / sizeof(trans_table[0])); k++)
+    {
+        const trans_params* p = &trans_table[k];
+
+        if(p->M == M && p->N == N && p->s == TRANS_S && p->E == TRANS_E && p->b == TRANS_B)
+            return p;
+    }
+    return NULL;
+}
+
+/*
+ * SIMD kernels: a square tile of ints is loaded one row per vector
+ * register, transposed with unpack and lane shuffles, and stored one row
+ * of B per register. 4x4 needs SSE2, 8x8 AVX2 and 16x16 AVX-512F; the
+ * widest one the CPU supports is picked at the first call, and CPUs (or
+ * compilers) without any of them get trans_recursive. Tiles are visited
+ * in TRANS_SIMD_BLOCK blocks so the lines of B a block half-fills are
+ * still cached when its neighbours fill the other half.
+ */
+#define TRANS_SIMD_BLOCK 64
+
+typedef void (*trans_simd_kernel)(const int* a, int lda, int* b, int ldb);
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void trans_4x4_sse2(const int* a, int lda, int* b, int ldb)
+{
+    __m128i r0 = _mm_loadu_si128((const __m128i*)(a));
+    __m128i r1 = _mm_loadu_si128((const __m128i*)(a + lda));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)(a + 2 * lda));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)(a + 3 * lda));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128((__m128i*)(b), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i*)(b + ldb), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i*)(b + 2 * ldb), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i*)(b + 3 * ldb), _mm_unpackhi_epi64(t2, t3));
+    return;
+}
+
+__attribute__((target("avx2")))
+static void trans_8x8_avx2(const int* a, int lda, int* b, int ldb)
+{
+    __m256i r[8], t[8], u[8];
+
+    for(int k = 0; k < 8; k++)
+    {
+        r[k] = _mm256_loadu_si256((const __m256i*)(a + k * lda));
+    }
+    for(int k = 0; k < 8; k += 2) //pairs of rows interleaved
+    {
+        t[k] = _mm256_unpacklo_epi32(r[k], r[k + 1]);
+        t[k + 1] = _mm256_unpackhi_epi32(r[k], r[k + 1]);
+    }
+    for(int k = 0; k < 8; k += 4) //column c of four rows in each 128-bit lane
+    {
+        u[k] = _mm256_unpacklo_epi64(t[k], t[k + 2]);
+        u[k + 1] = _mm256_unpackhi_epi64(t[k], t[k + 2]);
+        u[k + 2] = _mm256_unpacklo_epi64(t[k + 1], t[k + 3]);
+        u[k + 3] = _mm256_unpackhi_epi64(t[k + 1], t[k + 3]);
+    }
+    for(int c = 0; c < 4; c++) //join the lanes of rows 0-3 and 4-7
+    {
+        _mm256_storeu_si256((__m256i*)(b + c * ldb), _mm256_permute2x128_si256(u[c], u[c + 4], 0x20));
+        _mm256_storeu_si256((__m256i*)(b + (c + 4) * ldb), _mm256_permute2x128_si256(u[c], u[c + 4], 0x31));
+    }
+    return;
+}
+
+__attribute__((target("avx512f")))
+static void trans_16x16_avx512(const int* a, int lda, int* b, int ldb)
+{
+    __m512i r[16], t[16], u[16];
+
+    for(int k = 0; k < 16; k++)
+    {
+        r[k] = _mm512_loadu_si512((const void*)(a + k * lda));
+    }
+    for(int k = 0; k < 16; k += 2)
+    {
+        t[k] = _mm512_unpacklo_epi32(r[k], r[k + 1]);
+        t[k + 1] = _mm512_unpackhi_epi32(r[k], r[k + 1]);
+    }
+    for(int k = 0; k < 16; k += 4)
+    {
+        u[k] = _mm512_unpacklo_epi64(t[k], t[k + 2]);
+        u[k + 1] = _mm512_unpackhi_epi64(t[k], t[k + 2]);
+        u[k + 2] = _mm512_unpacklo_epi64(t[k + 1], t[k + 3]);
+        u[k + 3] = _mm512_unpackhi_epi64(t[k + 1], t[k + 3]);
+    }
+    for(int c = 0; c < 4; c++) //gather lane l of rows 0-3, 4-7, 8-11, 12-15 into column 4l+c
+    {
+        __m512i x = _mm512_shuffle_i32x4(u[c], u[c + 4], 0x44);
+        __m512i y = _mm512_shuffle_i32x4(u[c], u[c + 4], 0xee);
+        __m512i z = _mm512_shuffle_i32x4(u[c + 8], u[c + 12], 0x44);
+        __m512i w = _mm512_shuffle_i32x4(u[c + 8], u[c + 12], 0xee);
+
+        _mm512_storeu_si512((void*)(b + c * ldb), _mm512_shuffle_i32x4(x, z, 0x88));
+        _mm512_storeu_si512((void*)(b + (c + 4) * ldb), _mm512_shuffle_i32x4(x, z, 0xdd));
+        _mm512_storeu_si512((void*)(b + (c + 8) * ldb), _mm512_shuffle_i32x4(y, w, 0x88));
+        _mm512_storeu_si512((void*)(b + (c + 12) * ldb), _mm512_shuffle_i32x4(y, w, 0xdd));
+    }
+    return;
+}
+#endif
+
+/*
+ * trans_simd_select - Return the widest kernel the CPU runs and set *tile
+ *     to its size, or return NULL.
+ */
+static trans_simd_kernel trans_simd_select(int* tile)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        *tile = 16;
+        return trans_16x16_avx512;
+    }
+    if(__builtin_cpu_supports("avx2"))
+    {
+        *tile = 8;
+        return trans_8x8_avx2;
+    }
+    if(__builtin_cpu_supports("sse2"))
+    {
+        *tile = 4;
+        return trans_4x4_sse2;
+    }
+#endif
+    *tile = 0;
+    return NULL;
+}
+
+/*
+ * trans_simd_get - trans_simd_select, run once.
+ */
+static trans_simd_kernel trans_simd_get(int* tile)
+{
+    static trans_simd_kernel kernel = NULL;
+    static int kernel_tile = -1;
+
+    if(kernel_tile < 0)
+        kernel = trans_simd_select(&kernel_tile);
+    *tile = kernel_tile;
+    return kernel;
+}
+
+/*
+ * trans_simd_run - Transpose columns j0..j1 of A (rows j0..j1 of B) with
+ *     kernel on tile x tile tiles, j0 being a multiple of tile; the strips
+ *     left at the right and bottom edges go through trans_rows.
+ */
+static void trans_simd_run(int M, int N, int A[N][M], int B[M][N], trans_simd_kernel kernel, int tile, int j0, int j1)
+{
+    int J1 = j0 + (j1 - j0) / tile * tile;
+    int N1 = N - N % tile;
+
+    for(int ib = 0; ib < N1; ib += TRANS_SIMD_BLOCK)
+    {
+        for(int jb = j0; jb < J1; jb += TRANS_SIMD_BLOCK)
+        {
+            for(int i = ib; i < ib + TRANS_SIMD_BLOCK && i < N1; i += tile)
+            {
+                for(int j = jb; j < jb + TRANS_SIMD_BLOCK && j < J1; j += tile)
+                {
+                    kernel(&A[i][j], M, &B[j][i], N);
+                }
+            }
+        }
+    }
+    if(J1 < j1)
+        trans_rows(M, N, A, B, 0, N, J1, j1);
+    if(N1 < N)
+        trans_rows(M, N, A, B, N1, N, j0, J1);
+    return;
+}
+
+/*
+ * Parallel transpose: the rows of B are cut into one contiguous panel per
+ * thread, so every thread streams its own part of B and A is shared
+ * read-only. Panel edges fall on whole tiles and on cache line boundaries
+ * of B (given a line-aligned B), so no two threads ever write the same
+ * line. Threads are started per call; the matrices this is meant for take
+ * far longer to transpose than pthread_create.
+ */
+#define TRANS_MAX_THREADS 64
+#define TRANS_LINE_BYTES 64
+#define TRANS_LINE_INTS (TRANS_LINE_BYTES / (int)sizeof(int))
+#define TRANS_PARALLEL_MIN (1 << 18) //fewer elements than this stay on one thread
+
+/* Threads transpose_threads uses, 0 for one per online CPU; tracing callers set 1 */
+int trans_threads = 0;
+
+typedef struct //One thread's panel
+{
+    int M, N;
+    int* A;
+    int* B;
+    int j0, j1; //rows of B
+} trans_panel;
+
+static void* trans_panel_thread(void* arg)
+{
+    trans_panel* p = arg;
+    int M = p->M, N = p->N;
+    int (*A)[M] = (int (*)[M])p->A;
+    int (*B)[N] = (int (*)[N])p->B;
+    int tile;
+    trans_simd_kernel kernel = trans_simd_get(&tile);
+
+    if(kernel == NULL)
+        trans_recursive(M, N, A, B, 0, N, p->j0, p->j1);
+    else
+        trans_simd_run(M, N, A, B, kernel, tile, p->j0, p->j1);
+    return NULL;
+}
+
+/*
+ * trans_parallel - Transpose with up to threads threads (0 for one per
+ *     online CPU).
+ */
+static void trans_parallel(int M, int N, int A[N][M], int B[M][N], int threads)
+{
+    pthread_t tid[TRANS_MAX_THREADS];
+    trans_panel panel[TRANS_MAX_THREADS];
+    int unit = TRANS_LINE_INTS;
+    int n = N;
+    int tile, units, started = 0;
+
+    if(threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > TRANS_MAX_THREADS)
+        threads = TRANS_MAX_THREADS;
+    if((long int)M * N < TRANS_PARALLEL_MIN)
+        threads = 1;
+
+    //smallest number of B rows that spans whole lines, rounded up to whole kernel tiles
+    while(unit % 2 == 0 && n % 2 == 0)
+    {
+        unit /= 2;
+        n /= 2;
+    }
+    trans_simd_get(&tile);
+    while(unit < tile)
+        unit *= 2;
+
+    units = (M + unit - 1) / unit;
+    if(threads > units)
+        threads = units;
+    if(threads < 1)
+        threads = 1;
+
+    for(int t = 0; t < threads; t++)
+    {
+        panel[t].M = M;
+        panel[t].N = N;
+        panel[t].A = &A[0][0];
+        panel[t].B = &B[0][0];
+        panel[t].j0 = (int)((long int)units * t / threads) * unit;
+        panel[t].j1 = (int)((long int)units * (t + 1) / threads) * unit;
+        if(panel[t].j1 > M)
+            panel[t].j1 = M;
+    }
+    for(int t = 1; t < threads; t++) //this thread takes panel 0
+    {
+        if(pthread_create(&tid[t], NULL, trans_panel_thread, &panel[t]) != 0)
+            break;
+        started = t;
+    }
+    trans_panel_thread(&panel[0]);
+    for(int t = 1; t <= started; t++)
+    {
+        pthread_join(tid[t], NULL);
+    }
+    for(int t = started + 1; t < threads; t++) //threads that could not be created
+    {
+        trans_panel_thread(&panel[t]);
+    }
+    return;
+}
+
+/*
+ * In-place transpose: A (N rows of M) is overwritten by its M x N
+ * transpose. Square matrices swap tiles across the diagonal. Other shapes
+ * transpose every t x t tile in place and then permute the t-int chunks
+ * (one cache block each) into place by following the cycles of the chunk
+ * permutation, a bitmap marking the chunks already placed. t is one cache
+ * block; when a side is not a multiple of t, the ragged right and bottom
+ * strips (fewer than t columns or rows) are copied out, the core is
+ * compacted, tiled and spread back out, and the strips are written last.
+ */
+#define TRANS_INPLACE_TILE ((1 << TRANS_B) / (int)sizeof(int))
+
+/*
+ * trans_inplace_square - Swap A[i][j] and A[j][i] tile pair by tile pair.
+ */
+static void trans_inplace_square(int n, int* A)
+{
+    for(int i0 = 0; i0 < n; i0 += TRANS_INPLACE_TILE)
+    {
+        for(int j0 = i0; j0 < n; j0 += TRANS_INPLACE_TILE)
+        {
+            for(int i = i0; i < i0 + TRANS_INPLACE_TILE && i < n; i++)
+            {
+                for(int j = (j0 == i0 ? i + 1 : j0); j < j0 + TRANS_INPLACE_TILE && j < n; j++)
+                {
+                    int tmp = A[(long int)i * n + j];
+
+                    A[(long int)i * n + j] = A[(long int)j * n + i];
+                    A[(long int)j * n + i] = tmp;
+                }
+            }
+        }
+    }
+    return;
+}
+
+/*
+ * trans_inplace_cycles - Transpose an N x M A whose sides are multiples of
+ *     t, using placed, a zeroed bitmap of M * N / t bits.
+ */
+static void trans_inplace_cycles(int M, int N, int* A, int t, unsigned char* placed)
+{
+    long int Mt = M / t, Nt = N / t;
+    long int units = (long int)M * N / t; //chunk (ti, a, tj) holds A[ti*t + a][tj*t .. tj*t + t)
+    int carry[TRANS_INPLACE_TILE], swap[TRANS_INPLACE_TILE];
+
+    //transpose each tile in place, so chunk (ti, a, tj) holds column tj*t + a of the rows ti*t ..
+    for(long int ti = 0; ti < Nt; ti++)
+    {
+        for(long int tj = 0; tj < Mt; tj++)
+        {
+            int* tile = A + ti * t * M + tj * t;
+
+            for(int a = 0; a < t; a++)
+            {
+                for(int b = a + 1; b < t; b++)
+                {
+                    int tmp = tile[(long int)a * M + b];
+
+                    tile[(long int)a * M + b] = tile[(long int)b * M + a];
+                    tile[(long int)b * M + a] = tmp;
+                }
+            }
+        }
+    }
+
+    //chunk (ti, a, tj) belongs at chunk (tj, a, ti) of the M x N result
+    for(long int u = 0; u < units; u++)
+    {
+        long int cur = u;
+
+        if(placed[u / 8] & (1 << (u % 8)))
+            continue;
+        memcpy(carry, A + u * t, t * sizeof(int));
+        do
+        {
+            long int ti = cur / (t * Mt), a = cur / Mt % t, tj = cur % Mt;
+
+            cur = (tj * t + a) * Nt + ti;
+            memcpy(swap, A + cur * t, t * sizeof(int));
+            memcpy(A + cur * t, carry, t * sizeof(int));
+            memcpy(carry, swap, t * sizeof(int));
+            placed[cur / 8] |= 1 << (cur % 8);
+        } while(cur != u);
+    }
+    return;
+}
+
+/*
+ * trans_inplace - Overwrite the N x M matrix A with its M x N transpose.
+ *     Returns 0, or -1 if the scratch bitmap cannot be allocated, in which
+ *     case A is unchanged.
+ */
+int trans_inplace(int M, int N, int* A)
+{
+    int t = TRANS_INPLACE_TILE;
+    int Mc = M - M % t, Nc = N - N % t; //the core, whose sides are multiples of t
+    int rm = M - Mc, rn = N - Nc;
+    unsigned char* placed;
+    int* edge; //rows Nc.. of A, then columns Mc.. of rows ..Nc
+
+    if(M == N)
+    {
+        trans_inplace_square(M, A);
+        return 0;
+    }
+    placed = calloc(((long int)Mc * Nc / t + 7) / 8 + 1, 1);
+    edge = malloc(((long int)rn * M + (long int)Nc * rm + 1) * sizeof(int));
+    if(placed == NULL || edge == NULL)
+    {
+        free(placed);
+        free(edge);
+        return -1;
+    }
+
+    memcpy(edge, A + (long int)Nc * M, (long int)rn * M * sizeof(int));
+    for(long int i = 0; i < Nc; i++)
+    {
+        memcpy(edge + (long int)rn * M + i * rm, A + i * M + Mc, rm * sizeof(int));
+        memmove(A + i * Mc, A + i * M, Mc * sizeof(int)); //rows move down, never over a row still to move
+    }
+    trans_inplace_cycles(Mc, Nc, A, t, placed);
+
+    //spread the Mc x Nc result to rows of N, last row first, and append the bottom strip
+    for(long int j = Mc - 1; j >= 0; j--)
+    {
+        memmove(A + j * N, A + j * Nc, Nc * sizeof(int));
+        for(int k = 0; k < rn; k++)
+        {
+            A[j * N + Nc + k] = edge[(long int)k * M + j];
+        }
+    }
+    //rows Mc.. come from the right strip and the corner
+    for(long int j = Mc; j < M; j++)
+    {
+        for(long int i = 0; i < Nc; i++)
+        {
+            A[j * N + i] = edge[(long int)rn * M + i * rm + (j - Mc)];
+        }
+        for(int k = 0; k < rn; k++)
+        {
+            A[j * N + Nc + k] = edge[(long int)k * M + j];
+        }
+    }
+    free(placed);
+    free(edge);
+    return 0;
+}
+
+/*
+ * Typed transposes on strided views: trans_u<bits>(M, N, A, lda, B, ldb)
+ * writes the M x N transpose of the N x M matrix whose rows start lda
+ * elements apart into rows of B ldb elements apart, so sub-matrices of
+ * larger arrays are transposed without a copy. float, complex float and
+ * complex double data go through the u32, u64 and u128 versions. Tiles
+ * are TRANS_LINE_BYTES / sizeof(element) on a side, so every tile row
+ * is one cache line; full 32-bit tiles go through the SIMD kernel.
+ */
+typedef struct //16-byte element, e.g. a complex double
+{
+    uint64_t lo, hi;
+} trans_elem128;
+
+#define TRANS_DEFINE_TYPED(name, T) \
+void name(int M, int N, const T* A, long int lda, T* B, long int ldb) \
+{ \
+    const int tile = TRANS_LINE_BYTES / (int)sizeof(T); \
+    trans_simd_kernel kernel = NULL; \
+    int kernel_tile = 0; \
+ \
+    if(sizeof(T) == sizeof(int) && lda <= INT_MAX && ldb <= INT_MAX) \
+        kernel = trans_simd_get(&kernel_tile); \
+ \
+    for(int i0 = 0; i0 < N; i0 += tile) \
+    { \
+        for(int j0 = 0; j0 < M; j0 += tile) \
+        { \
+            int i1 = i0 + tile < N ? i0 + tile : N; \
+            int j1 = j0 + tile < M ? j0 + tile : M; \
+ \
+            if(kernel != NULL && i1 - i0 == tile && j1 - j0 == tile) \
+            { \
+                for(int i = i0; i < i1; i += kernel_tile) \
+                { \
+                    for(int j = j0; j < j1; j += kernel_tile) \
+                    { \
+                        kernel((const int*)(A + i * lda + j), (int)lda, (int*)(B + j * ldb + i), (int)ldb); \
+                    } \
+                } \
+                continue; \
+            } \
+            for(int i = i0; i < i1; i++) \
+            { \
+                for(int j = j0; j < j1; j++) \
+                { \
+                    B[j * ldb + i] = A[i * lda + j]; \
+                } \
+            } \
+        } \
+    } \
+}
+
+TRANS_DEFINE_TYPED(trans_u8, uint8_t)
+TRANS_DEFINE_TYPED(trans_u16, uint16_t)
+TRANS_DEFINE_TYPED(trans_u32, uint32_t)
+TRANS_DEFINE_TYPED(trans_u64, uint64_t)
+TRANS_DEFINE_TYPED(trans_u128, trans_elem128)
+
+/*
+ * Fused transposes: the op is applied as each element of A^T is produced,
+ * instead of in a second pass over B, on the same strided views and line
+ * tiles as the typed transposes.
+ *     trans_scale_<t>  B = alpha * A^T
+ *     trans_axpy_<t>   B += alpha * A^T
+ *     trans_conj_<t>   B = alpha * A^H (complex types only)
+ * for t = f32, f64, c64 (float complex) and c128 (double complex). Full
+ * f32 tiles are transposed by the SIMD kernel into a one-tile buffer in
+ * L1 and applied to B from there a row at a time.
+ */
+#define TRANS_OP_SCALE(b, a, alpha) ((b) = (alpha) * (a))
+#define TRANS_OP_AXPY(b, a, alpha) ((b) += (alpha) * (a))
+#define TRANS_OP_CONJF(b, a, alpha) ((b) = (alpha) * conjf(a))
+#define TRANS_OP_CONJ(b, a, alpha) ((b) = (alpha) * conj(a))
+
+#define TRANS_DEFINE_FUSED(name, T, OP) \
+void name(int M, int N, T alpha, const T* A, long int lda, T* B, long int ldb) \
+{ \
+    enum { tile = TRANS_LINE_BYTES / sizeof(T) }; \
+    T buf[tile * tile]; \
+    trans_simd_kernel kernel = NULL; \
+    int kernel_tile = 0; \
+ \
+    if(sizeof(T) == sizeof(int) && lda <= INT_MAX) \
+        kernel = trans_simd_get(&kernel_tile); \
+ \
+    for(int i0 = 0; i0 < N; i0 += tile) \
+    { \
+        for(int j0 = 0; j0 < M; j0 += tile) \
+        { \
+            int i1 = i0 + tile < N ? i0 + tile : N; \
+            int j1 = j0 + tile < M ? j0 + tile : M; \
+ \
+            if(kernel != NULL && i1 - i0 == tile && j1 - j0 == tile) \
+            { \
+                for(int i = 0; i < tile; i += kernel_tile) \
+                { \
+                    for(int j = 0; j < tile; j += kernel_tile) \
+                    { \
+                        kernel((const int*)(A + (i0 + i) * lda + j0 + j), (int)lda, (int*)(buf + j * tile + i), tile); \
+                    } \
+                } \
+                for(int j = 0; j < tile; j++) \
+                { \
+                    for(int i = 0; i < tile; i++) \
+                    { \
+                        OP(B[(j0 + j) * ldb + i0 + i], buf[j * tile + i], alpha); \
+                    } \
+                } \
+                continue; \
+            } \
+            for(int i = i0; i < i1; i++) \
+            { \
+                for(int j = j0; j < j1; j++) \
+                { \
+                    OP(B[j * ldb + i], A[i * lda + j], alpha); \
+                } \
+            } \
+        } \
+    } \
+}
+
+TRANS_DEFINE_FUSED(trans_scale_f32, float, TRANS_OP_SCALE)
+TRANS_DEFINE_FUSED(trans_scale_f64, double, TRANS_OP_SCALE)
+TRANS_DEFINE_FUSED(trans_scale_c64, float complex, TRANS_OP_SCALE)
+TRANS_DEFINE_FUSED(trans_scale_c128, double complex, TRANS_OP_SCALE)
+TRANS_DEFINE_FUSED(trans_axpy_f32, float, TRANS_OP_AXPY)
+TRANS_DEFINE_FUSED(trans_axpy_f64, double, TRANS_OP_AXPY)
+TRANS_DEFINE_FUSED(trans_axpy_c64, float complex, TRANS_OP_AXPY)
+TRANS_DEFINE_FUSED(trans_axpy_c128, double complex, TRANS_OP_AXPY)
+TRANS_DEFINE_FUSED(trans_conj_c64, float complex, TRANS_OP_CONJF)
+TRANS_DEFINE_FUSED(trans_conj_c128, double complex, TRANS_OP_CONJ)
+
+/*
+ * trans_oblivious - The general engine on its own, for comparison with the
+ *     tuned paths of transpose_submit on their shapes.
+ */
+char trans_oblivious_desc[] = "Cache-oblivious recursive transpose";
+void trans_oblivious(int M, int N, int A[N][M], int B[M][N])
+{
+    trans_recursive(M, N, A, B, 0, N, 0, M);
+}
+
+/*
+ * transpose_simd - Blocked transpose through the widest SIMD kernel the
+ *     CPU supports.
+ */
+char transpose_simd_desc[] = "SIMD tiled transpose";
+void transpose_simd(int M, int N, int A[N][M], int B[M][N])
+{
+    int tile;
+    trans_simd_kernel kernel = trans_simd_get(&tile);
+
+    if(kernel == NULL)
+        trans_recursive(M, N, A, B, 0, N, 0, M);
+    else
+        trans_simd_run(M, N, A, B, kernel, tile, 0, M);
+}
+
+/*
+ * transpose_threads - The SIMD tiled transpose split across one thread
+ *     per online CPU, or trans_threads threads when it is set.
+ */
+char transpose_threads_desc[] = "Multi-threaded SIMD tiled transpose";
+void transpose_threads(int M, int N, int A[N][M], int B[M][N])
+{
+    trans_parallel(M, N, A, B, trans_threads);
+}
+
+/*
+ * transpose_inplace - Copy A into B and transpose it there in place, so the
+ *     driver can check and time trans_inplace.
+ */
+char transpose_inplace_desc[] = "In-place transpose";
+void transpose_inplace(int M, int N, int A[N][M], int B[M][N])
+{
+    memcpy(&B[0][0], &A[0][0], (size_t)M * N * sizeof(int));
+    if(trans_inplace(M, N, &B[0][0]) != 0)
+        trans_recursive(M, N, A, B, 0, N, 0, M);
+}
+
+/*
+ * transpose_typed - The 32-bit typed transpose on the whole matrices.
+ */
+char transpose_typed_desc[] = "Typed strided transpose (32-bit)";
+void transpose_typed(int M, int N, int A[N][M], int B[M][N])
+{
+    trans_u32(M, N, (const uint32_t*)&A[0][0], M, (uint32_t*)&B[0][0], N);
+}
 
 /* 
  * trans - A simple baseline transpose function, not optimized for the cache.
@@ -170,8 +1019,8 @@ void trans(int M, int N, int A[N][M], int B[M][N])
 
     for (i = 0; i < N; i++) {
         for (j = 0; j < M; j++) {
-            tmp = A[i][j];
-            B[j][i] = tmp;
+            tmp = TRANS_READ(A[i][j]);
+            TRANS_WRITE(B[j][i]) = tmp;
         }
     }    
 
@@ -191,6 +1040,11 @@ void registerFunctions()
 
     /* Register any additional transpose functions */
     registerTransFunction(trans, trans_desc); 
+    registerTransFunction(trans_oblivious, trans_oblivious_desc);
+    registerTransFunction(transpose_simd, transpose_simd_desc);
+    registerTransFunction(transpose_threads, transpose_threads_desc);
+    registerTransFunction(transpose_inplace, transpose_inplace_desc);
+    registerTransFunction(transpose_typed, transpose_typed_desc);
 
 }
 
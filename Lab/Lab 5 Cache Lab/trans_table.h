@@ -0,0 +1,12 @@
+/* Generated by tune, do not edit: ./tune -g 5:1:5 -g 6:8:6 32x32 64x64 61x67 */
+
+static const trans_params trans_table[] =
+{
+    /* M, N, s, E, b, bi, bj, sub, order */
+    {32, 32, 5, 1, 5, 8, 8, 1, 0}, /* 280 misses */
+    {64, 64, 5, 1, 5, 8, 8, 1, 0}, /* 1104 misses */
+    {61, 67, 5, 1, 5, 17, 4, 0, 0}, /* 1708 misses */
+    {32, 32, 6, 8, 6, 32, 32, 0, 0}, /* 128 misses */
+    {64, 64, 6, 8, 6, 32, 32, 0, 0}, /* 512 misses */
+    {61, 67, 6, 8, 6, 32, 32, 0, 0}, /* 512 misses */
+};
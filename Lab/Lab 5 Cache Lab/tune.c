@@ -0,0 +1,198 @@
+/* 20220100 Kihyun Park */
+
+/*
+ * tune.c - Autotuner for the blocked transpose kernel of trans.c
+ *
+ * For every matrix shape and cache geometry asked for, each tile shape
+ * (1..32 x 1..32), sub-block scheme and tile traversal order is run on
+ * real matrices while every A/B access is replayed through the cache
+ * simulator. The candidate with the fewest misses is written to
+ * trans_table.h, which transpose_submit looks up before its hand-tuned
+ * paths.
+ *
+ * Build: gcc -O2 -o tune tune.c cachesim.c cachelab.c
+ * Usage: ./tune [-g s:E:b]... [-o trans_table.h] MxN...
+ */
+#include "cachesim.h"
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int* TraceAccess(int* p, char op);
+
+#define TRANS_READ(x) (*TraceAccess(&(x), 'L'))
+#define TRANS_WRITE(x) (*TraceAccess(&(x), 'S'))
+#include "trans.c"
+
+#define MAX_DIM 256  //Largest M and N, as in the course driver
+#define MAX_TILE 32  //Largest tile side tried
+#define MAX_GEOMETRIES 16
+
+typedef struct //Best candidate found for one shape and cache
+{
+    trans_params params;
+    unsigned long int misses;
+} TuneResult;
+
+/* A and B back to back like the driver's static matrices */
+static int matrices[2][MAX_DIM * MAX_DIM] __attribute__((aligned(1 << 16)));
+static cache_t* cache = NULL;
+
+static int* TraceAccess(int* p, char op)
+{
+    if(cache != NULL)
+        cache_access(cache, (unsigned long int)p, sizeof(int), op);
+    return p;
+}
+
+/*
+ * Score - Return the misses of one candidate, or -1 if it does not
+ *     transpose correctly.
+ */
+static long int Score(const trans_params* p)
+{
+    int (*A)[p->M] = (int (*)[p->M])matrices[0];
+    int (*B)[p->N] = (int (*)[p->N])matrices[1];
+    cache_config_t config;
+    cache_stats_t stats;
+
+    for(int i = 0; i < p->N * p->M; i++)
+    {
+        matrices[0][i] = i;
+        matrices[1][i] = -1;
+    }
+
+    memset(&config, 0, sizeof(config));
+    config.s = p->s;
+    config.E = p->E;
+    config.b = p->b;
+    if((cache = cache_create(&config)) == NULL)
+    {
+        fprintf(stderr, "%d:%d:%d: Cannot create the cache\n", p->s, p->E, p->b);
+        exit(1);
+    }
+    trans_blocked(p->M, p->N, A, B, p);
+    cache_stats(cache, &stats);
+    cache_destroy(cache);
+    cache = NULL;
+
+    if(!is_transpose(p->M, p->N, A, B))
+        return -1;
+    return (long int)stats.miss_count;
+}
+
+static TuneResult Tune(int M, int N, int s, int E, int b)
+{
+    TuneResult best;
+    trans_params p;
+
+    memset(&best, 0, sizeof(best));
+    best.misses = (unsigned long int)-1;
+    memset(&p, 0, sizeof(p));
+    p.M = M;
+    p.N = N;
+    p.s = s;
+    p.E = E;
+    p.b = b;
+
+    for(p.bi = 1; p.bi <= MAX_TILE && p.bi <= N; p.bi++)
+    {
+        for(p.bj = 1; p.bj <= MAX_TILE && p.bj <= M; p.bj++)
+        {
+            for(p.sub = 0; p.sub <= (p.bi == 8 && p.bj == 8); p.sub++)
+            {
+                for(p.order = 0; p.order <= 1; p.order++)
+                {
+                    long int misses = Score(&p);
+
+                    if(misses < 0)
+                        continue;
+                    //ties go to the larger tile, which has less loop overhead
+                    if((unsigned long int)misses < best.misses ||
+                       ((unsigned long int)misses == best.misses && p.bi * p.bj > best.params.bi * best.params.bj))
+                    {
+                        best.params = p;
+                        best.misses = misses;
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    int geometry[MAX_GEOMETRIES][3];
+    int geometry_count = 0;
+    char* output = "trans_table.h";
+    FILE* out;
+    int opt;
+
+    while((opt = getopt(argc, argv, "g:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'g':
+                if(geometry_count == MAX_GEOMETRIES ||
+                   sscanf(optarg, "%d:%d:%d", &geometry[geometry_count][0], &geometry[geometry_count][1], &geometry[geometry_count][2]) != 3)
+                {
+                    fprintf(stderr, "%s: Expected s:E:b\n", optarg);
+                    return 1;
+                }
+                geometry_count++;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+        }
+    }
+    if(geometry_count == 0) //the graded cache
+    {
+        geometry[0][0] = 5;
+        geometry[0][1] = 1;
+        geometry[0][2] = 5;
+        geometry_count = 1;
+    }
+    if(optind == argc)
+    {
+        fprintf(stderr, "Usage: %s [-g s:E:b]... [-o trans_table.h] MxN...\n", argv[0]);
+        return 1;
+    }
+
+    if((out = fopen(output, "w")) == NULL)
+    {
+        fprintf(stderr, "%s: Cannot open output file\n", output);
+        return 1;
+    }
+    fprintf(out, "/* Generated by tune, do not edit: ./tune");
+    for(int i = 1; i < argc; i++)
+    {
+        fprintf(out, " %s", argv[i]);
+    }
+    fprintf(out, " */\n\nstatic const trans_params trans_table[] =\n{\n");
+    fprintf(out, "    /* M, N, s, E, b, bi, bj, sub, order */\n");
+
+    for(int g = 0; g < geometry_count; g++)
+    {
+        for(int i = optind; i < argc; i++)
+        {
+            int M, N;
+            TuneResult r;
+
+            if(sscanf(argv[i], "%dx%d", &M, &N) != 2 || M < 1 || N < 1 || M > MAX_DIM || N > MAX_DIM)
+            {
+                fprintf(stderr, "%s: Expected MxN up to %dx%d\n", argv[i], MAX_DIM, MAX_DIM);
+                return 1;
+            }
+            r = Tune(M, N, geometry[g][0], geometry[g][1], geometry[g][2]);
+            printf("%dx%d s=%d E=%d b=%d: %dx%d tiles, sub %d, order %d, %lu misses\n", M, N,
+                   r.params.s, r.params.E, r.params.b, r.params.bi, r.params.bj, r.params.sub, r.params.order, r.misses);
+            fprintf(out, "    {%d, %d, %d, %d, %d, %d, %d, %d, %d}, /* %lu misses */\n", M, N,
+                    r.params.s, r.params.E, r.params.b, r.params.bi, r.params.bj, r.params.sub, r.params.order, r.misses);
+        }
+    }
+    fprintf(out, "};\n");
+    fclose(out);
+    return 0;
+}
@@ -3,6 +3,7 @@
  * 
  * Name: Kihyun Park / POVIS ID: kihyun
  */
+#define _GNU_SOURCE /* splice, strchrnul */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -11,13 +12,21 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
 #include <errno.h>
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
+#define MAXCMDS MAXARGS   /* max commands in a pipeline */
+#define JOBCHUNK     16   /* job records added to the pool at a time */
 #define MAXJID    1<<16   /* max job ID */
+#define PATHCHUNK    64   /* initial buckets of the path cache */
+#define DEFPATH "/bin:/usr/bin" /* searched when PATH is not set */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -39,16 +48,85 @@
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
+int use_fork = 0;           /* if true, launch every command with fork instead of posix_spawn */
 int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
+struct proc_t {             /* One process of a job */
+    pid_t pid;              /* process ID, 0 once out of the pid index */
+    struct job_t *job;      /* the job it belongs to */
+    struct proc_t *pid_next; /* next process in the same pid hash bucket */
+};
+
 struct job_t {              /* The job struct */
-    pid_t pid;              /* job PID */
+    pid_t pid;              /* job PID: the process group ID, which is the PID of the first process */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
+    char *cmdline;          /* command line */
+    size_t cmdcap;          /* bytes allocated for cmdline, kept when the record is reused */
+    struct proc_t *procs;   /* the processes of the pipeline, in order */
+    int nprocs;
+    int proccap;            /* records allocated in procs, kept when the record is reused */
+    int live;               /* processes not reaped yet */
+    int termsig;            /* signal that killed one of them, 0 if none */
+    struct job_t *jid_next; /* next job in the same jid hash bucket */
+    struct job_t *prev;     /* neighbours in jid order; next also links the free list */
+    struct job_t *next;
+};
+
+/*
+ * The job table. Records come from a pool that only grows, so a record
+ * never moves and deleting a job (from sigchld_handler) never calls
+ * free. Live processes are indexed by pid and live jobs by jid in two
+ * hash tables of intrusive chains, and jobs are kept on a list in jid
+ * order, whose tail gives the largest jid; the FG job, if any, is cached
+ * in fg. The table only grows in addjob, which runs with every signal
+ * blocked.
+ */
+struct jobs_t {
+    struct proc_t **pid_hash; /* bucket heads, nbuckets of them */
+    struct job_t **jid_hash;
+    int nbuckets;            /* power of two */
+    int count;               /* live jobs */
+    int nprocs;              /* processes in pid_hash */
+    struct job_t *head;      /* lowest jid */
+    struct job_t *tail;      /* highest jid */
+    struct job_t *free;      /* unused records */
+    struct job_t *fg;        /* the FG job, NULL if none */
+};
+struct jobs_t jobtable;
+struct jobs_t *jobs = &jobtable; /* The job list */
+
+struct pathent_t {          /* One cached command */
+    char *name;             /* command name, as typed */
+    char *path;             /* file found for it in PATH */
+    int hits;               /* times it was looked up to be run */
+    struct pathent_t *next; /* next command in the same bucket */
+};
+
+/*
+ * The path cache, like hash in bash: command names already resolved
+ * through PATH, so that a repeated command does not probe every PATH
+ * directory again. It is emptied when PATH differs from the value it was
+ * filled under, and a command is dropped when running its file fails
+ * with ENOENT. Only the main loop uses it, never a signal handler.
+ */
+struct paths_t {
+    struct pathent_t **buckets; /* chain heads, nbuckets of them */
+    int nbuckets;            /* power of two */
+    int count;               /* cached commands */
+    char *path;              /* PATH the commands were found in */
+};
+struct paths_t pathtable;
+struct paths_t *paths = &pathtable; /* The path cache */
+
+struct cmd_t {              /* One command of a pipeline */
+    char **argv;            /* arguments, NULL-terminated */
+    char *path;             /* file to run, argv[0] resolved through PATH */
+    char *infile;           /* < file, NULL if none */
+    char *outfile;          /* > or >> file, NULL if none */
+    int append;             /* outfile was given with >> */
 };
-struct job_t jobs[MAXJOBS]; /* The job list */
 /* End global variables */
 
 
@@ -57,7 +135,9 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
 int builtin_cmd(char **argv);
+int isbuiltin(const char *name);
 void do_bgfg(char **argv);
+void do_hash(char **argv);
 void waitfg(pid_t pid);
 
 void sigchld_handler(int sig);
@@ -66,18 +146,31 @@ void sigint_handler(int sig);
 
 /* Here are helper routines that we've provided for you */
 int parseline(const char *cmdline, char **argv); 
+int parsepipeline(char **argv, struct cmd_t *cmds);
+void runcmd(struct cmd_t *cmd, int in_fd, int out_fd, int stale_fd);
+pid_t forkcmd(struct cmd_t *cmd, int in_fd, int out_fd, int close_fd, pid_t pgid, sigset_t *mask);
+pid_t spawncmd(struct cmd_t *cmd, int in_fd, int out_fd, int close_fd, pid_t pgid, sigset_t *mask);
+void benchlaunch(int count, int ballast);
+int splicecmd(char **argv);
 void sigquit_handler(int sig);
 
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *jobs);
-int maxjid(struct job_t *jobs); 
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *jobs, pid_t pid); 
-pid_t fgpid(struct job_t *jobs);
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
-struct job_t *getjobjid(struct job_t *jobs, int jid); 
+void initjobs(struct jobs_t *jobs);
+int maxjid(struct jobs_t *jobs); 
+int addjob(struct jobs_t *jobs, pid_t *pids, int npids, int state, char *cmdline);
+int deletejob(struct jobs_t *jobs, pid_t pid); 
+int reapproc(struct jobs_t *jobs, pid_t pid);
+void setjobstate(struct jobs_t *jobs, struct job_t *job, int state);
+pid_t fgpid(struct jobs_t *jobs);
+struct job_t *getjobpid(struct jobs_t *jobs, pid_t pid);
+struct job_t *getjobjid(struct jobs_t *jobs, int jid); 
 int pid2jid(pid_t pid); 
-void listjobs(struct job_t *jobs);
+void listjobs(struct jobs_t *jobs);
+
+void clearpaths(struct paths_t *paths);
+char *pathlookup(struct paths_t *paths, char *name, int use);
+void pathforget(struct paths_t *paths, const char *name);
+void listpaths(struct paths_t *paths);
 
 void usage(void);
 void unix_error(char *msg);
@@ -93,13 +186,15 @@ int main(int argc, char **argv)
     char c;
     char cmdline[MAXLINE];
     int emit_prompt = 1; /* emit prompt (default) */
+    int bench = 0;       /* commands to launch in the benchmark, 0 for none */
+    int ballast = 0;     /* MB the benchmark adds to the resident set */
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpfl:m:")) != EOF) {
         switch (c) {
             case 'h':             /* print help message */
                 usage();
@@ -110,6 +205,15 @@ int main(int argc, char **argv)
             case 'p':             /* don't print a prompt */
                 emit_prompt = 0;  /* handy for automatic testing */
                 break;
+            case 'f':             /* launch commands with fork */
+                use_fork = 1;
+                break;
+            case 'l':             /* launch-latency benchmark */
+                bench = atoi(optarg);
+                break;
+            case 'm':             /* resident set ballast for the benchmark */
+                ballast = atoi(optarg);
+                break;
 	        default:
             usage();
 	    }
@@ -128,6 +232,11 @@ int main(int argc, char **argv)
     /* Initialize the job list */
     initjobs(jobs);
 
+    if (bench > 0) {
+        benchlaunch(bench, ballast);
+        exit(0);
+    }
+
     /* Execute the shell's read/eval loop */
     while (1) {
 
@@ -155,22 +264,28 @@ int main(int argc, char **argv)
 /* 
  * eval - Evaluate the command line that the user has just typed in
  * 
- * If the user has requested a built-in command (quit, jobs, bg or fg)
- * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
- * each child process must have a unique process group ID so that our
- * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.  
+ * If the user has requested a built-in command (quit, jobs, bg, fg or
+ * hash) then execute it immediately. Otherwise, look every command of
+ * the pipeline up in PATH, start a child process for each one, connect them with pipes and run the
+ * job in the context of the children. If the job is running in the
+ * foreground, wait for it to terminate and then return.  Note: each
+ * job must have a unique process group ID so that our background
+ * children don't receive SIGINT (SIGTSTP) from the kernel when we type
+ * ctrl-c (ctrl-z) at the keyboard; all the processes of a pipeline
+ * share the group of the first one.
 */
 void eval(char *cmdline) 
 {
     char *argv[MAXARGS];                   //argument list execve()
     char buf[MAXLINE];                     //holds modified command line
+    struct cmd_t cmds[MAXCMDS];            //commands of the pipeline
+    pid_t pids[MAXCMDS];                   //their process ids
+    int ncmds, npids = 0;                  //number of commands, of processes started
     int bg;                                //should the job run in bg or fg?
-    pid_t pid;                             //process id
+    pid_t pid, pgid = 0;                   //process id, process group id of the job
+    int in_fd = -1, fds[2];                //read end of the previous pipe, next pipe
     int state;                             //job state
-    sigset_t mask_all, mask_one, prev_one; //signal set
+    sigset_t mask_all, mask_one, prev_one, prev_all; //signal set
 
     strcpy(buf, cmdline);
     bg = parseline(buf, argv);
@@ -178,7 +293,18 @@ void eval(char *cmdline)
     if(argv[0] == NULL)
         return; //ignore empty lines
 
-    if(!builtin_cmd(argv))
+    if((ncmds = parsepipeline(argv, cmds)) < 0)                 //split the pipeline and its redirections
+        return;
+    for(int k = 0; k < ncmds; k++)
+    {
+        if(isbuiltin(cmds[k].argv[0]) && (ncmds > 1 || cmds[k].infile != NULL || cmds[k].outfile != NULL)) //builtins run in the shell itself, so they have no stdin or stdout of their own
+        {
+            printf("%s: Builtin commands cannot be piped or redirected\n", cmds[k].argv[0]);
+            return;
+        }
+    }
+
+    if(!builtin_cmd(argv)) //argv now holds the first command's words alone
     {
         if(sigfillset(&mask_all) < 0)                           //add every signal to set
             app_error("Sigfillset error");                      //sigfillset error handling
@@ -189,36 +315,56 @@ void eval(char *cmdline)
         if(sigprocmask(SIG_BLOCK, &mask_one, &prev_one) < 0)    //block SIGCHLD signals
             unix_error("Sigprocmask error");                    //sigprocmask error handling
 
-        if((pid = fork()) == 0) //child runs user job
+        for(int k = 0; k < ncmds; k++)
         {
-            if(setpgid(0, 0) < 0)                               //put the child in a new process group whose group ID is identical to the child's PID
-                unix_error("Setpgid error");                    //setpgid error handling
-            if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0)   //unblock SIGCHLD signals
-                unix_error("Sigprocmask error");                //sigprocmask error handling
+            fds[0] = fds[1] = -1;
+            if(k < ncmds - 1 && pipe(fds) < 0)                  //connect this command to the next one
+                unix_error("Pipe error");                       //pipe error handling
 
-            if(execve(argv[0], argv, environ) < 0)              //load and run the executable object file argv[0] with the argument list argv and the environment variable list environ
+            if(strcmp(cmds[k].argv[0], "splice") && (cmds[k].path = pathlookup(paths, cmds[k].argv[0], 1)) == NULL)
             {
-                printf("%s: Command not found\n", argv[0]);     //execve error handling
-                exit(0);
+                fprintf(stderr, "%s: Command not found\n", cmds[k].argv[0]); //no such file in PATH
+                pid = 0;
             }
+            else if(!use_fork && strcmp(cmds[k].argv[0], "splice"))   //splice runs in a copy of the shell, so it needs fork
+            {
+                pid = spawncmd(&cmds[k], in_fd, fds[1], fds[0], pgid, &prev_one);
+            }
+            else
+            {
+                pid = forkcmd(&cmds[k], in_fd, fds[1], fds[0], pgid, &prev_one);
+            }
+
+            if(pid > 0)
+            {
+                if(pgid == 0)
+                    pgid = pid;
+                setpgid(pid, pgid);   //also from here, so the group exists before the next fork; fails harmlessly if the child has already exec'd
+                pids[npids++] = pid;
+            }
+            if(in_fd >= 0)
+                close(in_fd);
+            if(fds[1] >= 0)
+                close(fds[1]);
+            in_fd = fds[0];
         }
-        else if (pid < 0)
-        {
-            unix_error("Fork error"); //fork error handling
-        }
-        else
+
+        if(npids > 0) //not every command failed to start
         {
-            if(sigprocmask(SIG_BLOCK, &mask_all, NULL) < 0)     //block every signal
-                unix_error("Sigprocmask error");                //sigprocmask error handling
-            addjob(jobs, pid, state, cmdline);                  //add a job to the job list
-            if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0)   //unblock every signal
-                unix_error("Sigprocmask error");                //sigprocmask error handling
+            if(sigprocmask(SIG_BLOCK, &mask_all, &prev_all) < 0) //block every signal
+                unix_error("Sigprocmask error");                 //sigprocmask error handling
+            addjob(jobs, pids, npids, state, cmdline);           //add a job to the job list
+            if(sigprocmask(SIG_SETMASK, &prev_all, NULL) < 0)    //unblock every signal but SIGCHLD, so the job cannot be reaped yet
+                unix_error("Sigprocmask error");                 //sigprocmask error handling
 
             if(!bg) //foreground
-                waitfg(pid);                                             //block until process pid is no longer the foreground process
+                waitfg(pgid);                                              //block until process pgid is no longer the foreground process
             else    //background
-                printf("[%d] (%d) %s", pid2jid(pid), (int)pid, cmdline); //print the information of the background job
-        }  
+                printf("[%d] (%d) %s", pid2jid(pgid), (int)pgid, cmdline); //print the information of the background job
+        }
+
+        if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0)    //unblock SIGCHLD signals
+            unix_error("Sigprocmask error");                 //sigprocmask error handling
     }
 
     return;
@@ -281,6 +427,354 @@ int parseline(const char *cmdline, char **argv)
     return bg;
 }
 
+/*
+ * parsepipeline - Split the argv built by parseline into the commands
+ *     of a pipeline at "|" words, taking "< file", "> file" and
+ *     ">> file" out of each command's arguments. The operators must be
+ *     words of their own. Returns the number of commands, or -1 after
+ *     printing an error.
+ */
+int parsepipeline(char **argv, struct cmd_t *cmds)
+{
+    int n = 0; //current command
+    int j = 0; //next free slot of argv, which is compacted in place
+
+    memset(&cmds[0], 0, sizeof(cmds[0]));
+    cmds[0].argv = argv;
+    for(int i = 0; argv[i] != NULL; i++)
+    {
+        if(!strcmp(argv[i], "|"))
+        {
+            argv[j++] = NULL;                             //end of the current command
+            if(cmds[n].argv[0] == NULL || n == MAXCMDS - 1)
+            {
+                printf("Missing command in pipeline\n");
+                return -1;
+            }
+            n++;
+            memset(&cmds[n], 0, sizeof(cmds[n]));
+            cmds[n].argv = &argv[j];
+        }
+        else if(!strcmp(argv[i], "<") || !strcmp(argv[i], ">") || !strcmp(argv[i], ">>"))
+        {
+            if(argv[i + 1] == NULL || !strcmp(argv[i + 1], "|"))
+            {
+                printf("%s: Missing file name\n", argv[i]);
+                return -1;
+            }
+            if(argv[i][0] == '<')
+            {
+                cmds[n].infile = argv[i + 1];
+            }
+            else
+            {
+                cmds[n].outfile = argv[i + 1];
+                cmds[n].append = (argv[i][1] == '>');
+            }
+            i++;
+        }
+        else
+        {
+            argv[j++] = argv[i];
+        }
+    }
+    argv[j] = NULL;
+    if(cmds[n].argv[0] == NULL)
+    {
+        printf("Missing command in pipeline\n");
+        return -1;
+    }
+    return n + 1;
+}
+
+/*
+ * runcmd - In a child: read from in_fd and write to out_fd (when they
+ *     are not -1), apply the command's redirections on top, and run it.
+ *     If the file cached for the command has gone, one byte is written
+ *     to stale_fd (when it is not -1) so the shell can drop it too.
+ *     Never returns. It leaves with _exit, since exit would seek the
+ *     shell's stdin back to what this copy of its stdio buffer had read.
+ */
+void runcmd(struct cmd_t *cmd, int in_fd, int out_fd, int stale_fd)
+{
+    int fd;
+
+    if(in_fd >= 0)
+    {
+        if(dup2(in_fd, STDIN_FILENO) < 0)  //read from the previous command
+            unix_error("Dup2 error");      //dup2 error handling
+        close(in_fd);
+    }
+    if(out_fd >= 0)
+    {
+        if(dup2(out_fd, STDOUT_FILENO) < 0) //write to the next command
+            unix_error("Dup2 error");       //dup2 error handling
+        close(out_fd);
+    }
+    if(cmd->infile != NULL)
+    {
+        if((fd = open(cmd->infile, O_RDONLY)) < 0)
+        {
+            fprintf(stderr, "%s: %s\n", cmd->infile, strerror(errno)); //open error handling
+            _exit(1);
+        }
+        if(dup2(fd, STDIN_FILENO) < 0)
+            unix_error("Dup2 error");
+        close(fd);
+    }
+    if(cmd->outfile != NULL)
+    {
+        if((fd = open(cmd->outfile, O_WRONLY | O_CREAT | (cmd->append ? O_APPEND : O_TRUNC), 0666)) < 0)
+        {
+            fprintf(stderr, "%s: %s\n", cmd->outfile, strerror(errno)); //open error handling
+            _exit(1);
+        }
+        if(dup2(fd, STDOUT_FILENO) < 0)
+            unix_error("Dup2 error");
+        close(fd);
+    }
+
+    if(!strcmp(cmd->argv[0], "splice"))  //builtin that runs in the job's own process
+    {
+        Signal(SIGINT, SIG_DFL);         //execve would drop the shell's handlers, so ctrl-c/ctrl-z reach splice itself
+        Signal(SIGTSTP, SIG_DFL);
+        Signal(SIGQUIT, SIG_DFL);
+        Signal(SIGCHLD, SIG_DFL);
+        _exit(splicecmd(cmd->argv));
+    }
+
+    if(execve(cmd->path, cmd->argv, environ) < 0)                 //load and run the executable object file path with the argument list argv and the environment variable list environ
+    {
+        if(errno == ENOENT && cmd->path != cmd->argv[0])          //the cached file went away, so search PATH again
+        {
+            if(stale_fd >= 0 && write(stale_fd, "", 1) < 0)       //this is the shell's copy of the cache, not the shell's own
+                unix_error("Write error");                        //write error handling
+            pathforget(paths, cmd->argv[0]);
+            if((cmd->path = pathlookup(paths, cmd->argv[0], 0)) != NULL)
+                execve(cmd->path, cmd->argv, environ);
+        }
+        fprintf(stderr, "%s: Command not found\n", cmd->argv[0]); //execve error handling
+        _exit(0);
+    }
+}
+
+/*
+ * forkcmd - Start a command with fork: the child joins process group
+ *     pgid (a new one if 0), runs with the signal mask mask, does not
+ *     keep close_fd, and goes on in runcmd. The shell waits until the
+ *     child has exec'd or failed to, through a close-on-exec pipe, so
+ *     that a cached file the child found gone is dropped from the
+ *     shell's path cache too. Returns the pid.
+ */
+pid_t forkcmd(struct cmd_t *cmd, int in_fd, int out_fd, int close_fd, pid_t pgid, sigset_t *mask)
+{
+    int stale[2] = {-1, -1}; //written by the child if the cached file went away
+    char c;
+    pid_t pid;
+
+    if(cmd->path != NULL && cmd->path != cmd->argv[0] && pipe2(stale, O_CLOEXEC) < 0) //only commands found through PATH are cached
+        unix_error("Pipe error");                                //pipe error handling
+
+    if((pid = fork()) == 0) //child runs user job
+    {
+        if(setpgid(0, pgid) < 0)                        //put the child in the process group of the job, a new one for the first command
+            unix_error("Setpgid error");                //setpgid error handling
+        if(sigprocmask(SIG_SETMASK, mask, NULL) < 0)    //unblock SIGCHLD signals
+            unix_error("Sigprocmask error");            //sigprocmask error handling
+        if(close_fd >= 0)
+            close(close_fd);                            //the next command's end of the pipe
+        if(stale[0] >= 0)
+            close(stale[0]);
+        runcmd(cmd, in_fd, out_fd, stale[1]);           //never returns
+    }
+    else if (pid < 0)
+    {
+        unix_error("Fork error"); //fork error handling
+    }
+
+    if(stale[0] >= 0)
+    {
+        close(stale[1]);
+        if(read(stale[0], &c, 1) == 1)                  //end of file once the child has exec'd or exited
+        {
+            pathforget(paths, cmd->argv[0]);
+            pathlookup(paths, cmd->argv[0], 0);         //cache where the child looks for it next
+        }
+        close(stale[0]);
+    }
+    return pid;
+}
+
+/*
+ * spawncmd - Start a command with posix_spawn, which does not copy the
+ *     shell's page tables the way fork does. Like the fork path, the
+ *     child joins process group pgid (a new one if 0), runs with the
+ *     signal mask mask, reads in_fd and writes out_fd (when they are not
+ *     -1) with the command's redirections on top, and does not inherit
+ *     close_fd. Returns the pid, or 0 after printing an error if the
+ *     command could not be started.
+ */
+pid_t spawncmd(struct cmd_t *cmd, int in_fd, int out_fd, int close_fd, pid_t pgid, sigset_t *mask)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int in_file = -1, out_file = -1;   //redirections, opened here so their errors are not taken for exec errors
+    pid_t pid = 0;
+    int err;
+
+    if(cmd->infile != NULL && (in_file = open(cmd->infile, O_RDONLY | O_CLOEXEC)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", cmd->infile, strerror(errno)); //open error handling
+        return 0;
+    }
+    if(cmd->outfile != NULL &&
+       (out_file = open(cmd->outfile, O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append ? O_APPEND : O_TRUNC), 0666)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", cmd->outfile, strerror(errno)); //open error handling
+        if(in_file >= 0)
+            close(in_file);
+        return 0;
+    }
+
+    if((err = posix_spawn_file_actions_init(&actions)) != 0 || (err = posix_spawnattr_init(&attr)) != 0)
+    {
+        errno = err;
+        unix_error("Posix_spawn error");
+    }
+    if(in_fd >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);   //read from the previous command
+        posix_spawn_file_actions_addclose(&actions, in_fd);
+    }
+    if(out_fd >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO); //write to the next command
+        posix_spawn_file_actions_addclose(&actions, out_fd);
+    }
+    if(close_fd >= 0)
+        posix_spawn_file_actions_addclose(&actions, close_fd);             //the next command's end of the pipe
+    if(in_file >= 0)
+        posix_spawn_file_actions_adddup2(&actions, in_file, STDIN_FILENO);
+    if(out_file >= 0)
+        posix_spawn_file_actions_adddup2(&actions, out_file, STDOUT_FILENO);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, pgid);  //the process group of the job, a new one for the first command
+    posix_spawnattr_setsigmask(&attr, mask); //SIGCHLD unblocked again
+
+    err = posix_spawn(&pid, cmd->path, &actions, &attr, cmd->argv, environ);
+    if(err == ENOENT && cmd->path != cmd->argv[0])                      //the cached file went away, so search PATH again
+    {
+        pathforget(paths, cmd->argv[0]);
+        if((cmd->path = pathlookup(paths, cmd->argv[0], 0)) != NULL)
+            err = posix_spawn(&pid, cmd->path, &actions, &attr, cmd->argv, environ);
+    }
+    if(err != 0)
+    {
+        fprintf(stderr, "%s: Command not found\n", cmd->argv[0]); //posix_spawn error handling
+        pid = 0;
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if(in_file >= 0)
+        close(in_file);
+    if(out_file >= 0)
+        close(out_file);
+    return pid;
+}
+
+/*
+ * benchlaunch - Time count foreground runs of /bin/true through eval,
+ *     first with fork and then with posix_spawn, after growing the
+ *     shell's resident set by ballast MB.
+ */
+void benchlaunch(int count, int ballast)
+{
+    char cmdline[] = "/bin/true\n";
+    char *mem = NULL;
+    struct timespec start, end;
+
+    if(ballast > 0 && (mem = malloc((size_t)ballast << 20)) != NULL)
+        memset(mem, 1, (size_t)ballast << 20); //touch every page, so fork has to copy its page tables
+
+    for(use_fork = 1; use_fork >= 0; use_fork--)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(int i = 0; i < count; i++)
+            eval(cmdline);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-11s %d commands, %.1f us per command (%d MB resident ballast)\n", use_fork ? "fork:" : "posix_spawn:", count,
+               ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / count, mem != NULL ? ballast : 0);
+    }
+    free(mem);
+    return;
+}
+
+/*
+ * splicecmd - The splice builtin: "splice [src [dst]]" copies src to
+ *     dst, stdin and stdout by default or for "-", without copying the
+ *     data through user space. splice is tried first (one end must be a
+ *     pipe), then sendfile (the source must be a regular file), then
+ *     plain read/write. It runs as a job, so it can be a stage of a
+ *     pipeline and ctrl-c/ctrl-z reach it. Returns the exit status.
+ */
+int splicecmd(char **argv)
+{
+    int in = STDIN_FILENO, out = STDOUT_FILENO;
+    int method = 0; //0: splice, 1: sendfile, 2: read/write
+    char buf[MAXLINE * 8];
+    ssize_t n;
+
+    if(argv[1] != NULL && strcmp(argv[1], "-") && (in = open(argv[1], O_RDONLY)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+    if(argv[1] != NULL && argv[2] != NULL && strcmp(argv[2], "-") &&
+       (out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    while(1)
+    {
+        if(method == 0)
+            n = splice(in, NULL, out, NULL, 1 << 16, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else if(method == 1)
+            n = sendfile(out, in, NULL, 1 << 16);
+        else if((n = read(in, buf, sizeof(buf))) > 0)
+        {
+            for(ssize_t done = 0, w; done < n; done += w)
+            {
+                if((w = write(out, buf + done, n - done)) < 0)
+                {
+                    if(errno == EINTR)
+                    {
+                        w = 0;
+                        continue;
+                    }
+                    fprintf(stderr, "splice: %s\n", strerror(errno));
+                    return 1;
+                }
+            }
+        }
+
+        if(n == 0) //end of file
+            return 0;
+        if(n < 0 && errno != EINTR)
+        {
+            if(method < 2 && (errno == EINVAL || errno == ENOSYS)) //this pair of files does not support the method
+            {
+                method++;
+                continue;
+            }
+            fprintf(stderr, "splice: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+}
+
 /* 
  * builtin_cmd - If the user has typed a built-in command then execute
  *    it immediately.  
@@ -303,12 +797,37 @@ int builtin_cmd(char **argv)
     }
     else if(!strcmp(argv[0], "jobs")) //jobs command
     {
-        listjobs(jobs);               //print the job list
+        sigset_t mask_one, prev_one;  //signal set
+
+        if(sigemptyset(&mask_one) < 0)                        //initialize set to the empty set
+            app_error("Sigemptyset error");                   //sigemptyset error handling
+        if(sigaddset(&mask_one, SIGCHLD) < 0)                 //add SIGCHLD to signal set
+            app_error("Sigaddset error");                     //sigaddset error handling
+        if(sigprocmask(SIG_BLOCK, &mask_one, &prev_one) < 0)  //block SIGCHLD signals, so no job is deleted during the walk
+            unix_error("Sigprocmask error");                  //sigprocmask error handling
+        listjobs(jobs);                                       //print the job list
+        if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0)     //unblock SIGCHLD signals
+            unix_error("Sigprocmask error");                  //sigprocmask error handling
+        return 1;
+    }
+    else if(!strcmp(argv[0], "hash")) //hash command
+    {
+        do_hash(argv);                //execute the builtin hash command
         return 1;
     }
     return 0;     /* not a builtin command */
 }
 
+/*
+ * isbuiltin - Return true if name is one of the commands builtin_cmd
+ *    runs in the shell itself
+ */
+int isbuiltin(const char *name)
+{
+    return !strcmp(name, "quit") || !strcmp(name, "fg") || !strcmp(name, "bg") ||
+           !strcmp(name, "jobs") || !strcmp(name, "hash");
+}
+
 /* 
  * do_bgfg - Execute the builtin bg and fg commands
  */
@@ -317,69 +836,114 @@ void do_bgfg(char **argv)
     struct job_t* job;
     pid_t pid;
     int jid;
+    sigset_t mask_one, prev_one; //signal set
 
     if(argv[1] == NULL)
     {
         printf("%s command requires PID or %%jobid argument\n", argv[0]); //error handling
         return;
     }
-    else
+    if(argv[1][0] != '%' && atoi(argv[1]) == 0)
     {
-        if(argv[1][0] == '%') //jid
-        {
-            jid = atoi(argv[1] + 1);
+        printf("%s: argument must be a PID or %%jobid\n", argv[0]);       //error handling
+        return;
+    }
 
-            if((job = getjobjid(jobs, jid)) == NULL)  //find a job (by JID) on the job list
-            {
-                printf("%s: No such job\n", argv[1]); //error handling
-                return;
-            }
-        }
-        else                  //pid
-        {
-            if((pid = atoi(argv[1])) == 0)
-            {
-                printf("%s: argument must be a PID or %%jobid\n", argv[0]); //error handling
-                return;
-            }
-            else
-            {
-                if((job = getjobpid(jobs, pid)) == NULL)        //find a job (by PID) on the job list
-                {
-                    printf("(%s): No such process\n", argv[1]); //error handling
-                    return;
-                }
-            }
-        }
+    if(sigemptyset(&mask_one) < 0)                        //initialize set to the empty set
+        app_error("Sigemptyset error");                   //sigemptyset error handling
+    if(sigaddset(&mask_one, SIGCHLD) < 0)                 //add SIGCHLD to signal set
+        app_error("Sigaddset error");                     //sigaddset error handling
+    if(sigprocmask(SIG_BLOCK, &mask_one, &prev_one) < 0)  //block SIGCHLD signals, so the job is not reaped between the lookup and the update
+        unix_error("Sigprocmask error");                  //sigprocmask error handling
+
+    if(argv[1][0] == '%') //jid
+    {
+        jid = atoi(argv[1] + 1);
+        if((job = getjobjid(jobs, jid)) == NULL)        //find a job (by JID) on the job list
+            printf("%s: No such job\n", argv[1]);       //error handling
+    }
+    else                  //pid
+    {
+        pid = atoi(argv[1]);
+        if((job = getjobpid(jobs, pid)) == NULL)        //find a job (by PID) on the job list
+            printf("(%s): No such process\n", argv[1]); //error handling
+    }
+    if(job == NULL)
+    {
+        if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0) //unblock SIGCHLD signals
+            unix_error("Sigprocmask error");              //sigprocmask error handling
+        return;
     }
 
+    if(!strcmp(argv[0], "fg"))       //fg command
+        setjobstate(jobs, job, FG);  //set job state to FG
+    else                             //bg command
+        setjobstate(jobs, job, BG);  //set job state to BG
+
     if(kill(-job->pid, SIGCONT) < 0) //send SIGCONT signal to every process in process group |PID|
         unix_error("Kill error");    //kill error handling
 
     if(!strcmp(argv[0], "fg"))       //fg command
-    {
-        job->state = FG;             //set job state to FG
         waitfg(job->pid);            //block until process PID is no longer the foreground process
+    else                             //bg command
+        printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline); //print the information of the background job
+
+    if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0)     //unblock SIGCHLD signals
+        unix_error("Sigprocmask error");                  //sigprocmask error handling
+
+    return;
+}
+
+/*
+ * do_hash - Execute the builtin hash command: list the path cache,
+ *    empty it with -r, or look the names given up and cache them
+ */
+void do_hash(char **argv)
+{
+    if(argv[1] == NULL)
+    {
+        listpaths(paths); //print the cached commands
+        return;
     }
-    else if(!strcmp(argv[0], "bg"))  //bg command
+    for(int i = 1; argv[i] != NULL; i++)
     {
-        job->state = BG;                                          //set job state to BG
-        printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline); //print the information of the background job
+        if(!strcmp(argv[i], "-r"))
+            clearpaths(paths);                        //forget every command
+        else if(pathlookup(paths, argv[i], 0) == NULL)
+            printf("hash: %s: not found\n", argv[i]); //no such file in PATH
     }
-
     return;
 }
 
 /* 
  * waitfg - Block until process pid is no longer the foreground process
+ *
+ * SIGCHLD is blocked while the job is checked and only let in by
+ * sigsuspend, so a child that exits or stops between the check and the
+ * wait still wakes the shell up.
  */
 void waitfg(pid_t pid)
 {
-    if(getjobpid(jobs, pid) == NULL) //find a job (by PID) on the job list
-        return;
+    sigset_t mask_one, prev_one, wait_mask; //signal set
+
+    if(sigemptyset(&mask_one) < 0)                        //initialize set to the empty set
+        app_error("Sigemptyset error");                   //sigemptyset error handling
+    if(sigaddset(&mask_one, SIGCHLD) < 0)                 //add SIGCHLD to signal set
+        app_error("Sigaddset error");                     //sigaddset error handling
+    if(sigprocmask(SIG_BLOCK, &mask_one, &prev_one) < 0)  //block SIGCHLD signals
+        unix_error("Sigprocmask error");                  //sigprocmask error handling
+    wait_mask = prev_one;
+    if(sigdelset(&wait_mask, SIGCHLD) < 0)                //let SIGCHLD in while suspended
+        app_error("Sigdelset error");                     //sigdelset error handling
+
+    if(getjobpid(jobs, pid) != NULL) //find a job (by PID) on the job list
+    {
+        while(pid == fgpid(jobs))    //return PID of current foreground job, 0 if no such job
+            sigsuspend(&wait_mask);  //wait for a signal with SIGCHLD unblocked
+    }
 
-    while(pid == fgpid(jobs)) //return PID of current foreground job, 0 if no such job
-        sleep(1);             //suspend a process for a specified period of time
+    if(sigprocmask(SIG_SETMASK, &prev_one, NULL) < 0)     //restore the caller's mask
+        unix_error("Sigprocmask error");                  //sigprocmask error handling
 
     return;
 }
@@ -407,27 +971,30 @@ void sigchld_handler(int sig)
 
     while((wpid = waitpid(-1, &child_status, WNOHANG | WUNTRACED)) > 0) //suspend current process until specific process terminates
     {
-        job = getjobpid(jobs, wpid);       //find a job (by PID) on the job list
+        if((job = getjobpid(jobs, wpid)) == NULL) //find a job (by PID) on the job list
+            continue;
 
-        if(WIFEXITED(child_status))        //return true if the child terminated normally, via a call to exit or a return
+        if(WIFSTOPPED(child_status))       //return true if the child that caused the return is currently stopped
         {
-            if(sigprocmask(SIG_BLOCK, &mask_all, &prev_all) < 0) //block every signal
-                unix_error("Sigprocmask error");                 //sigprocmask error handling
-            deletejob(jobs, wpid);                               //delete a job whose PID = pid from the job list
-            if(sigprocmask(SIG_SETMASK, &prev_all, NULL) < 0)    //unblock every signal
-                unix_error("Sigprocmask error");                 //sigprocmask error handling
-        }
-        else if(WIFSTOPPED(child_status))  //return true if the child that caused the return is currently stopped
-        {
-            job->state = ST;               //set job state to ST
-            printf("Job [%d] (%d) stopped by signal %d\n", job->jid, job->pid, WSTOPSIG(child_status));
+            if(job->state != ST)           //report a pipeline once, when its first process stops
+            {
+                setjobstate(jobs, job, ST); //set job state to ST
+                printf("Job [%d] (%d) stopped by signal %d\n", job->jid, job->pid, WSTOPSIG(child_status));
+            }
         }
-        else if(WIFSIGNALED(child_status)) //return true if the child process terminated because of a signal that was not caught
+        else if(WIFEXITED(child_status) || WIFSIGNALED(child_status)) //the child terminated normally, or because of a signal that was not caught
         {
-            printf("Job [%d] (%d) terminated by signal %d\n", job->jid, job->pid, WTERMSIG(child_status));
+            if(WIFSIGNALED(child_status) && wpid == job->procs[job->nprocs - 1].pid) //a pipeline's status is its last command's
+                job->termsig = WTERMSIG(child_status);
+            if(job->live == 1 && job->termsig) //report the job once, when its last process is gone
+                printf("Job [%d] (%d) terminated by signal %d\n", job->jid, job->pid, job->termsig);
+
             if(sigprocmask(SIG_BLOCK, &mask_all, &prev_all) < 0) //block every signal
                 unix_error("Sigprocmask error");                 //sigprocmask error handling
-            deletejob(jobs, wpid);                               //delete a job whose PID = pid from the job list
+            if(job->live == 1)
+                deletejob(jobs, wpid);                           //delete a job whose PID = pid from the job list
+            else
+                reapproc(jobs, wpid);                            //the rest of the pipeline is still running
             if(sigprocmask(SIG_SETMASK, &prev_all, NULL) < 0)    //unblock every signal
                 unix_error("Sigprocmask error");                 //sigprocmask error handling
         }
@@ -489,147 +1056,311 @@ void clearjob(struct job_t *job)
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
-    job->cmdline[0] = '\0';
+    job->nprocs = 0;
+    job->live = 0;
+    job->termsig = 0;
+    if (job->cmdline != NULL)
+        job->cmdline[0] = '\0';
 }
 
 /* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs)
+void initjobs(struct jobs_t *jobs)
 {
-    int i;
-
-    for (i = 0; i < MAXJOBS; i++)
-	    clearjob(&jobs[i]);
+    memset(jobs, 0, sizeof(*jobs));
 }
 
 /* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs) 
+int maxjid(struct jobs_t *jobs)
+{
+    return jobs->tail != NULL ? jobs->tail->jid : 0;
+}
+
+/* hashjob - Bucket of a pid or jid */
+static int hashjob(struct jobs_t *jobs, int key)
+{
+    return (int)((unsigned int)key & (jobs->nbuckets - 1)); /* pids and jids are mostly sequential */
+}
+
+/* linkproc - Add a process to the pid index */
+static void linkproc(struct jobs_t *jobs, struct proc_t *proc)
 {
-    int i, max=0;
+    int i = hashjob(jobs, proc->pid);
 
-    for (i = 0; i < MAXJOBS; i++)
-        if (jobs[i].jid > max)
-            max = jobs[i].jid;
-    return max;
+    proc->pid_next = jobs->pid_hash[i];
+    jobs->pid_hash[i] = proc;
 }
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) 
+/* linkjob - Add a job to the jid index */
+static void linkjob(struct jobs_t *jobs, struct job_t *job)
 {
-    int i;
-    
-    if (pid < 1)
-	    return 0;
+    int i = hashjob(jobs, job->jid);
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == 0) {
-            jobs[i].pid = pid;
-            jobs[i].state = state;
-            jobs[i].jid = nextjid++;
-            if (nextjid > MAXJOBS)
-                nextjid = 1;
-            strcpy(jobs[i].cmdline, cmdline);
-            if(verbose) {
-                printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
-            }
-            return 1;
+    job->jid_next = jobs->jid_hash[i];
+    jobs->jid_hash[i] = job;
+}
+
+/*
+ * growjobs - Make sure there is a free job record and room in the hash
+ *     tables for nprocs more processes, doubling the tables once there
+ *     would be more processes than buckets. Returns 0 if out of memory,
+ *     leaving the table as it was.
+ */
+static int growjobs(struct jobs_t *jobs, int nprocs)
+{
+    struct job_t *job;
+    struct proc_t **pid_hash;
+    struct job_t **jid_hash;
+    int i, nbuckets;
+
+    if (jobs->free == NULL) {
+        if ((job = calloc(JOBCHUNK, sizeof(struct job_t))) == NULL)
+            return 0;
+        for (i = 0; i < JOBCHUNK; i++) {
+            job[i].next = jobs->free;
+            jobs->free = &job[i];
         }
     }
-    printf("Tried to create too many jobs\n");
-    return 0;
+    if (jobs->nprocs + nprocs <= jobs->nbuckets)
+        return 1;
+
+    nbuckets = jobs->nbuckets ? jobs->nbuckets : JOBCHUNK;
+    while (nbuckets < jobs->nprocs + nprocs)
+        nbuckets *= 2;
+    pid_hash = calloc(nbuckets, sizeof(struct proc_t *));
+    jid_hash = calloc(nbuckets, sizeof(struct job_t *));
+    if (pid_hash == NULL || jid_hash == NULL) {
+        free(pid_hash);
+        free(jid_hash);
+        return 0;
+    }
+    free(jobs->pid_hash);
+    free(jobs->jid_hash);
+    jobs->pid_hash = pid_hash;
+    jobs->jid_hash = jid_hash;
+    jobs->nbuckets = nbuckets;
+    for (job = jobs->head; job != NULL; job = job->next) {
+        for (i = 0; i < job->nprocs; i++)
+            if (job->procs[i].pid != 0)
+                linkproc(jobs, &job->procs[i]);
+        linkjob(jobs, job);
+    }
+    return 1;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid) 
+/* addjob - Add a job running the processes pids, in one process group, to the job list */
+int addjob(struct jobs_t *jobs, pid_t *pids, int npids, int state, char *cmdline)
 {
+    struct job_t *job;
+    size_t len;
     int i;
 
-    if (pid < 1)
+    if (npids < 1 || pids[0] < 1)
 	    return 0;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid == pid) {
-            clearjob(&jobs[i]);
-            nextjid = maxjid(jobs)+1;
-            return 1;
+    len = strlen(cmdline) + 1;
+    if (!growjobs(jobs, npids)) {
+        printf("Tried to create too many jobs\n");
+        return 0;
+    }
+    job = jobs->free;
+    if (job->cmdcap < len) {
+        char *buf = realloc(job->cmdline, len);
+
+        if (buf == NULL) {
+            printf("Tried to create too many jobs\n");
+            return 0;
         }
+        job->cmdline = buf;
+        job->cmdcap = len;
     }
-    return 0;
+    if (job->proccap < npids) {
+        struct proc_t *procs = realloc(job->procs, npids * sizeof(struct proc_t));
+
+        if (procs == NULL) {
+            printf("Tried to create too many jobs\n");
+            return 0;
+        }
+        job->procs = procs;
+        job->proccap = npids;
+    }
+    jobs->free = job->next;
+
+    job->pid = pids[0];
+    job->state = state;
+    job->jid = nextjid++;
+    memcpy(job->cmdline, cmdline, len);
+    job->nprocs = job->live = npids;
+    job->termsig = 0;
+    for (i = 0; i < npids; i++) {
+        job->procs[i].pid = pids[i];
+        job->procs[i].job = job;
+        linkproc(jobs, &job->procs[i]);
+    }
+    jobs->nprocs += npids;
+    linkjob(jobs, job);
+
+    /* nextjid is always maxjid+1, so the new job goes last in jid order */
+    job->prev = jobs->tail;
+    job->next = NULL;
+    if (jobs->tail != NULL)
+        jobs->tail->next = job;
+    else
+        jobs->head = job;
+    jobs->tail = job;
+    jobs->count++;
+    if (state == FG)
+        jobs->fg = job;
+
+    if(verbose) {
+        printf("Added job [%d] %d %s\n", job->jid, job->pid, job->cmdline);
+    }
+    return 1;
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs)
+/* unlinkproc - Take a process out of the pid index */
+static void unlinkproc(struct jobs_t *jobs, struct proc_t *proc)
 {
-    int i;
+    struct proc_t **link;
+
+    for (link = &jobs->pid_hash[hashjob(jobs, proc->pid)]; *link != proc; link = &(*link)->pid_next)
+        ;
+    *link = proc->pid_next;
+    proc->pid = 0;
+    jobs->nprocs--;
+}
+
+/*
+ * reapproc - Count a terminated process out of its job, leaving the job
+ *     to the rest of the pipeline. The first process stays in the pid
+ *     index until deletejob: its pid is the job's PID, which fg, bg and
+ *     waitfg look the job up by, and the kernel does not reuse it while
+ *     the process group is alive.
+ */
+int reapproc(struct jobs_t *jobs, pid_t pid)
+{
+    struct proc_t *proc;
 
-    for (i = 0; i < MAXJOBS; i++)
-	    if (jobs[i].state == FG)
-	        return jobs[i].pid;
-    return 0;
+    if (pid < 1 || jobs->nbuckets == 0)
+	    return 0;
+
+    for (proc = jobs->pid_hash[hashjob(jobs, pid)]; proc != NULL; proc = proc->pid_next)
+        if (proc->pid == pid)
+            break;
+    if (proc == NULL)
+        return 0;
+    proc->job->live--;
+    if (proc != &proc->job->procs[0])
+        unlinkproc(jobs, proc);
+    return 1;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid)
+/* deletejob - Delete the job with a process PID=pid from the job list */
+int deletejob(struct jobs_t *jobs, pid_t pid)
 {
+    struct job_t *job, **link;
     int i;
 
-    if (pid < 1)
+    if ((job = getjobpid(jobs, pid)) == NULL)
+        return 0;
+
+    for (i = 0; i < job->nprocs; i++)
+        if (job->procs[i].pid != 0)
+            unlinkproc(jobs, &job->procs[i]);
+
+    for (link = &jobs->jid_hash[hashjob(jobs, job->jid)]; *link != job; link = &(*link)->jid_next)
+        ;
+    *link = job->jid_next;
+
+    if (job->prev != NULL)
+        job->prev->next = job->next;
+    else
+        jobs->head = job->next;
+    if (job->next != NULL)
+        job->next->prev = job->prev;
+    else
+        jobs->tail = job->prev;
+    if (jobs->fg == job)
+        jobs->fg = NULL;
+    jobs->count--;
+
+    clearjob(job);
+    job->next = jobs->free;
+    jobs->free = job;
+    nextjid = maxjid(jobs)+1;
+    return 1;
+}
+
+/* setjobstate - Change the state of a job, keeping track of the FG job */
+void setjobstate(struct jobs_t *jobs, struct job_t *job, int state)
+{
+    if (jobs->fg == job)
+        jobs->fg = NULL;
+    job->state = state;
+    if (state == FG)
+        jobs->fg = job;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct jobs_t *jobs)
+{
+    return jobs->fg != NULL ? jobs->fg->pid : 0;
+}
+
+/* getjobpid  - Find a job (by the PID of any of its processes) on the job list */
+struct job_t *getjobpid(struct jobs_t *jobs, pid_t pid)
+{
+    struct proc_t *proc;
+
+    if (pid < 1 || jobs->nbuckets == 0)
 	    return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	    if (jobs[i].pid == pid)
-	        return &jobs[i];
+    for (proc = jobs->pid_hash[hashjob(jobs, pid)]; proc != NULL; proc = proc->pid_next)
+	    if (proc->pid == pid)
+	        return proc->job;
     return NULL;
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid) 
+struct job_t *getjobjid(struct jobs_t *jobs, int jid)
 {
-    int i;
+    struct job_t *job;
 
-    if (jid < 1)
+    if (jid < 1 || jobs->nbuckets == 0)
 	    return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-	    if (jobs[i].jid == jid)
-	        return &jobs[i];
+    for (job = jobs->jid_hash[hashjob(jobs, jid)]; job != NULL; job = job->jid_next)
+	    if (job->jid == jid)
+	        return job;
     return NULL;
 }
 
 /* pid2jid - Map process ID to job ID */
-int pid2jid(pid_t pid) 
+int pid2jid(pid_t pid)
 {
-    int i;
+    struct job_t *job = getjobpid(jobs, pid);
 
-    if (pid < 1)
-	    return 0;
-    for (i = 0; i < MAXJOBS; i++)
-	    if (jobs[i].pid == pid) {
-            return jobs[i].jid;
-        }
-    return 0;
+    return job != NULL ? job->jid : 0;
 }
 
 /* listjobs - Print the job list */
-void listjobs(struct job_t *jobs) 
+void listjobs(struct jobs_t *jobs)
 {
-    int i;
-    
-    for (i = 0; i < MAXJOBS; i++) {
-        if (jobs[i].pid != 0) {
-            printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-            switch (jobs[i].state) {
-                case BG: 
-                    printf("Running ");
-                    break;
-                case FG: 
-                    printf("Foreground ");
-                    break;
-                case ST: 
-                    printf("Stopped ");
-                    break;
-                default:
-                    printf("listjobs: Internal error: job[%d].state=%d ", i, jobs[i].state);
-            }
-            printf("%s", jobs[i].cmdline);
+    struct job_t *job;
+
+    for (job = jobs->head; job != NULL; job = job->next) {
+        printf("[%d] (%d) ", job->jid, job->pid);
+        switch (job->state) {
+            case BG:
+                printf("Running ");
+                break;
+            case FG:
+                printf("Foreground ");
+                break;
+            case ST:
+                printf("Stopped ");
+                break;
+            default:
+                printf("listjobs: Internal error: job[%d].state=%d ", job->jid, job->state);
         }
+        printf("%s", job->cmdline);
     }
 }
 /******************************
@@ -637,6 +1368,198 @@ void listjobs(struct job_t *jobs)
  ******************************/
 
 
+/*************************************************
+ * Helper routines that manipulate the path cache
+ ************************************************/
+
+/* hashname - Bucket of a command name (FNV-1a) */
+static int hashname(int nbuckets, const char *name)
+{
+    unsigned int h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return (int)(h & (nbuckets - 1));
+}
+
+/* clearpaths - Forget every cached command, keeping the buckets */
+void clearpaths(struct paths_t *paths)
+{
+    struct pathent_t *ent, *next;
+    int i;
+
+    for (i = 0; i < paths->nbuckets; i++) {
+        for (ent = paths->buckets[i]; ent != NULL; ent = next) {
+            next = ent->next;
+            free(ent);
+        }
+        paths->buckets[i] = NULL;
+    }
+    paths->count = 0;
+}
+
+/*
+ * searchpath - Probe each directory of the PATH value path for an
+ *     executable regular file called name. An empty directory means the
+ *     current one. Returns the full path in malloc'd memory, or NULL.
+ */
+static char *searchpath(const char *name, const char *path)
+{
+    size_t namelen = strlen(name);
+    struct stat st;
+    const char *dir, *end;
+    char *file;
+
+    for (dir = path; ; dir = end + 1) {
+        size_t dirlen;
+
+        end = strchrnul(dir, ':');
+        dirlen = end - dir;
+        if ((file = malloc(dirlen + namelen + 3)) == NULL)
+            return NULL;
+        if (dirlen == 0)
+            sprintf(file, "./%s", name);
+        else
+            sprintf(file, "%.*s/%s", (int)dirlen, dir, name);
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0)
+            return file;
+        free(file);
+        if (*end == '\0')
+            return NULL;
+    }
+}
+
+/*
+ * findpath - Look up name in the cache, starting over if PATH has
+ *     changed since the cache was filled. Returns the entry, or NULL.
+ */
+static struct pathent_t *findpath(struct paths_t *paths, const char *name)
+{
+    const char *path = getenv("PATH");
+    struct pathent_t *ent;
+
+    if (path == NULL)
+        path = DEFPATH;
+    if (paths->path == NULL || strcmp(paths->path, path)) {
+        char *copy = strdup(path);
+
+        if (copy == NULL)
+            return NULL;
+        clearpaths(paths);
+        free(paths->path);
+        paths->path = copy;
+    }
+    if (paths->nbuckets == 0)
+        return NULL;
+    for (ent = paths->buckets[hashname(paths->nbuckets, name)]; ent != NULL; ent = ent->next)
+        if (!strcmp(ent->name, name))
+            return ent;
+    return NULL;
+}
+
+/* growpaths - Double the buckets once there are more commands than buckets */
+static void growpaths(struct paths_t *paths)
+{
+    struct pathent_t **buckets, *ent, *next;
+    int i, j, nbuckets;
+
+    if (paths->count < paths->nbuckets)
+        return;
+    nbuckets = paths->nbuckets ? 2 * paths->nbuckets : PATHCHUNK;
+    if ((buckets = calloc(nbuckets, sizeof(struct pathent_t *))) == NULL)
+        return; /* keep the old buckets, only the chains get longer */
+    for (i = 0; i < paths->nbuckets; i++) {
+        for (ent = paths->buckets[i]; ent != NULL; ent = next) {
+            next = ent->next;
+            j = hashname(nbuckets, ent->name);
+            ent->next = buckets[j];
+            buckets[j] = ent;
+        }
+    }
+    free(paths->buckets);
+    paths->buckets = buckets;
+    paths->nbuckets = nbuckets;
+}
+
+/*
+ * pathlookup - Resolve a command name through PATH. Names with a slash
+ *     are returned as they are. Other names come from the cache, and
+ *     only a miss probes the PATH directories. If use is set the entry's
+ *     hit count goes up, as for a command that is about to run. Returns
+ *     NULL if there is no such command.
+ */
+char *pathlookup(struct paths_t *paths, char *name, int use)
+{
+    struct pathent_t *ent;
+    char *file;
+    size_t len;
+    int i;
+
+    if (strchr(name, '/') != NULL)
+        return name;
+    if ((ent = findpath(paths, name)) == NULL) {
+        if ((file = searchpath(name, paths->path != NULL ? paths->path : DEFPATH)) == NULL)
+            return NULL;
+        growpaths(paths);
+        len = strlen(name) + 1;
+        if (paths->nbuckets == 0 || (ent = malloc(sizeof(*ent) + len + strlen(file) + 1)) == NULL) {
+            free(file);
+            return NULL;
+        }
+        ent->name = (char *)(ent + 1); /* name and path live in the same block */
+        ent->path = ent->name + len;
+        memcpy(ent->name, name, len);
+        strcpy(ent->path, file);
+        free(file);
+        ent->hits = 0;
+        i = hashname(paths->nbuckets, name);
+        ent->next = paths->buckets[i];
+        paths->buckets[i] = ent;
+        paths->count++;
+    }
+    if (use)
+        ent->hits++;
+    return ent->path;
+}
+
+/* pathforget - Drop name from the cache, as after its file went away */
+void pathforget(struct paths_t *paths, const char *name)
+{
+    struct pathent_t *ent, **link;
+
+    if (paths->nbuckets == 0)
+        return;
+    for (link = &paths->buckets[hashname(paths->nbuckets, name)]; (ent = *link) != NULL; link = &ent->next) {
+        if (!strcmp(ent->name, name)) {
+            *link = ent->next;
+            free(ent);
+            paths->count--;
+            return;
+        }
+    }
+}
+
+/* listpaths - Print the cached commands */
+void listpaths(struct paths_t *paths)
+{
+    struct pathent_t *ent;
+    int i;
+
+    findpath(paths, ""); /* drops the entries if PATH has changed */
+    if (paths->count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (i = 0; i < paths->nbuckets; i++)
+        for (ent = paths->buckets[i]; ent != NULL; ent = ent->next)
+            printf("%4d\t%s\n", ent->hits, ent->path);
+}
+/********************************
+ * end path cache helper routines
+ *******************************/
+
+
 /***********************
  * Other helper routines
  ***********************/
@@ -646,10 +1569,13 @@ void listjobs(struct job_t *jobs)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpf] [-l count [-m MB]]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -f   launch commands with fork instead of posix_spawn\n");
+    printf("   -l   time count launches of /bin/true with fork and with posix_spawn, then exit\n");
+    printf("   -m   grow the resident set by MB before the -l benchmark\n");
     exit(1);
 }
 